@@ -5,22 +5,53 @@
 #error C++17 support is required to use slug
 #endif
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <numeric>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #ifndef IMPLICIT
 #define IMPLICIT
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#define SLUG_LIKELY(x) __builtin_expect(!!(x), 1)
+#define SLUG_COLD [[gnu::cold, gnu::noinline]]
+#elif defined(_MSC_VER)
+#define SLUG_LIKELY(x) (x)
+#define SLUG_COLD __declspec(noinline)
+#else
+#define SLUG_LIKELY(x) (x)
+#define SLUG_COLD
+#endif
+
 namespace slug {
 
 enum class log_level : std::uint8_t { Trace, Info, Warn, Error, Fatal, None };
@@ -32,100 +63,3385 @@ static constexpr auto const warn = log_level::Warn;
 static constexpr auto const info = log_level::Info;
 static constexpr auto const trace = log_level::Trace;
 
+/// \brief Action taken by callers when the output writer has stalled
+enum class stall_policy : std::uint8_t { Block, Drop, Fallback };
+
 #ifndef NDEBUG
 static constexpr auto const default_lvl = slug::info;
 #else
 static constexpr auto const default_lvl = slug::error;
 #endif
 
-/// \brief std::ostream class for sending output to a file or console
-/// \tparam CharT character type
-/// \tparam Traits character type traits
-template <typename CharT, typename Traits = std::char_traits<CharT>>
-class basic_logstream : public std::basic_ostream<CharT, Traits> {
- public:
-  using os_type = std::basic_ostream<CharT, Traits>;
-  using filebuf_type = std::basic_filebuf<CharT, Traits>;
-  using path_type = std::filesystem::path;
+/// \brief Handling of records larger than the atomic write size
+enum class oversize_policy : std::uint8_t { Split, Lock };
+
+/// \brief Handling of records larger than the record limit of a sink
+enum class long_record_policy : std::uint8_t { Truncate, Chunk };
+
+/// \brief Encoding of the records written to a sink
+enum class record_format : std::uint8_t { Text, Logfmt, Otlp };
+
+/// \brief Compression of files opened with open_compressed_file: Gzip
+/// requires zlib, Lz is slug's own block format read back with
+/// decompress_file, and Auto picks Gzip if slug was built with zlib
+enum class compression_codec : std::uint8_t { Auto, Gzip, Lz };
+
+/// \brief OpenTelemetry severity numbers indexed by log_level, the first
+/// number of each level's range
+static constexpr auto const otel_severity =
+    std::array<std::uint8_t, 5>{1, 9, 13, 17, 21};
+
+/// \brief Callback receiving errors slug cannot return to its caller, such
+/// as failures to open or write a log file, and status notices such as a
+/// stalled writer recovering, which arrive with an empty error code
+/// \param ec Error code, empty for status notices
+/// \param what Description of the failed operation
+using error_handler = void (*)(std::error_code const& ec, char const* what);
+
+/// \brief Sets the callback receiving errors
+/// \param handler New callback, or nullptr to restore the default callback
+/// which writes errors to stderr
+/// \returns Previous callback
+error_handler set_error_handler(error_handler handler) noexcept;
+
+namespace detail {
+
+/// \brief Passes an error to the current error handler
+void report_error(std::error_code const& ec, char const* what) noexcept;
+
+/// \brief Returns the error code for the current value of errno, or a
+/// generic stream error if errno is not set
+std::error_code last_error() noexcept;
+
+/// \brief Adds to the memory held by the calling thread's record buffers
+/// \param bytes Bytes allocated, or freed if negative
+void count_record_bytes(std::ptrdiff_t bytes) noexcept;
+
+/// \brief Returns the memory held by the record buffers of all threads,
+/// summed over the per-thread counts
+std::size_t record_bytes() noexcept;
+
+/// \brief Resizes a vector to a capacity of exactly size elements, which
+/// shrink_to_fit does not guarantee and skips entirely without exceptions
+template <typename T>
+void resize_exact(std::vector<T>& vec, std::size_t const size) {
+  if (vec.capacity() == size) {
+    vec.resize(size);
+    return;
+  }
+
+  auto resized = std::vector<T>(size);
+  std::copy_n(vec.begin(), std::min(size, vec.size()), resized.begin());
+  vec.swap(resized);
+}
+
+}  // namespace detail
+
+/// \brief Default upper bound for a single atomic append write in bytes
+static constexpr auto const default_atomic_write = std::size_t{4096};
+
+/// \brief Default output buffer size in characters
+static constexpr auto const default_buffer_size = std::size_t{8192};
+
+/// \brief Default size of independently compressed blocks in characters
+static constexpr auto const default_compress_block = std::size_t{65536};
+
+/// \brief Default compression level, from 1 for fastest to 9 for smallest
+static constexpr auto const default_compress_level = 6;
+
+/// \brief Age after which a partly filled compressed block is written by
+/// the next record
+static constexpr auto const compress_interval = std::chrono::seconds{1};
+
+/// \brief Assumed size of a cache line in bytes
+static constexpr auto const cache_line_size = std::size_t{64};
+
+/// \brief Memory held by a logger's buffers in bytes
+struct memory_usage {
+  /// \brief Output stream buffers
+  std::size_t stream_buffers{};
+
+  /// \brief Fallback output stream buffers
+  std::size_t fallback_buffers{};
+
+  /// \brief Record formatting buffers of all threads
+  std::size_t record_buffers{};
+
+  /// \brief Records held back while the output cannot be written
+  std::size_t spill_buffers{};
+
+  /// \brief Records batched by threads before they are written
+  std::size_t batch_buffers{};
+
+  /// \brief Returns the total memory held by all buffers
+  constexpr auto total() const noexcept {
+    return stream_buffers + fallback_buffers + record_buffers + spill_buffers +
+           batch_buffers;
+  }
+};
+
+/// \brief Snapshot of the counters of a sink
+struct sink_metrics {
+  /// \brief Upper bounds of the write latency buckets in nanoseconds, the
+  /// last bucket holds every longer write
+  static constexpr std::array<std::uint64_t, 7> latency_bounds{
+      1'000, 10'000, 100'000, 1'000'000, 10'000'000, 100'000'000,
+      1'000'000'000};
+
+  /// \brief Records written, indexed by log_level; log_level::None counts
+  /// records written to the sink directly
+  std::array<std::uint64_t, 6> records{};
+
+  /// \brief Bytes of the records written
+  std::uint64_t bytes{};
+
+  /// \brief Records dropped because the writer stalled
+  std::uint64_t dropped{};
+
+  /// \brief Records lost because of write errors
+  std::uint64_t lost{};
+
+  /// \brief Records currently held back because of write errors
+  std::uint64_t spilled{};
+
+  /// \brief Writes to the output stream, by latency bucket
+  std::array<std::uint64_t, latency_bounds.size() + 1> write_latency{};
+
+  /// \brief Total time spent writing to the output stream in nanoseconds
+  std::uint64_t write_time{};
+};
+
+/// \brief Writes sink metrics in the Prometheus text exposition format
+/// \param os Output stream
+/// \param sinks Sink names and their metrics
+void write_prometheus(
+    std::ostream& os,
+    std::vector<std::pair<std::string, sink_metrics>> const& sinks);
+
+/// \brief Periodically writes the metrics of sinks to a file in the
+/// Prometheus text exposition format, for a textfile collector
+/// \note The file is written to a temporary file in the same directory and
+/// renamed over the previous one, so readers never see a partial file
+class metrics_exporter {
+ public:
+  /// \brief Fills a snapshot of a sink's metrics
+  /// \returns false once the sink no longer exists
+  using source = std::function<bool(sink_metrics&)>;
+
+ private:
+  /// \brief File the metrics are written to
+  std::filesystem::path m_path;
+
+  /// \brief Interval between writes
+  std::chrono::milliseconds m_interval;
+
+  /// \brief Mutex for m_sources and m_stop
+  std::mutex m_mtx{};
+
+  /// \brief Wakes the export thread early when stopping
+  std::condition_variable m_cv{};
+
+  /// \brief Names and metrics sources of the exported sinks
+  std::vector<std::pair<std::string, source>> m_sources{};
+
+  /// \brief Set to stop the export thread
+  bool m_stop{false};
+
+  /// \brief Export thread
+  std::thread m_thread{};
+
+ public:
+  /// \brief Starts writing metrics to a file
+  /// \param filepath Path of the metrics file, usually ending in ".prom"
+  /// \param interval Interval between writes
+  explicit metrics_exporter(
+      std::filesystem::path filepath,
+      std::chrono::milliseconds interval = std::chrono::seconds{15});
+
+  metrics_exporter(metrics_exporter const&) = delete;
+
+  metrics_exporter& operator=(metrics_exporter const&) = delete;
+
+  /// \brief Writes the metrics a final time and stops the export thread
+  ~metrics_exporter();
+
+  /// \brief Adds a sink to the exported metrics; the exporter does not keep
+  /// the sink alive
+  /// \param name Value of the "sink" label of the sink's series
+  /// \param sink Sink to export
+  /// \returns *this
+  template <typename Sink>
+  metrics_exporter& add(std::string name, std::shared_ptr<Sink> const& sink) {
+    return add_source(std::move(name),
+                      [weak = std::weak_ptr<Sink>{sink}](sink_metrics& out) {
+                        auto const locked = weak.lock();
+                        if (locked) out = locked->metrics();
+                        return locked != nullptr;
+                      });
+  }
+
+  /// \brief Adds a metrics source to the exported metrics
+  /// \param name Value of the "sink" label of the source's series
+  /// \param src Metrics source
+  /// \returns *this
+  metrics_exporter& add_source(std::string name, source src);
+
+  /// \brief Writes the metrics file immediately
+  /// \returns true on success
+  bool write_now();
+
+ private:
+  /// \brief Writes the metrics file every m_interval until stopped
+  void run();
+};  // ^ metrics_exporter ^
+
+/// \brief Settings read from a configuration file of "key = value" lines,
+/// where '#' starts a comment
+///
+/// Recognized keys, applied by config_watcher:
+///   level = <level>                  default level of every logger
+///   level.<logger> = <level>         level of a single logger
+///   sink.<sink>.file = <path>        output file, opened when it changes in
+///                                    the mode of the open file
+///   sink.<sink>.stall_timeout = <ms>
+///   sink.<sink>.on_stall = block | drop | fallback
+///   sink.<sink>.record_limit = <characters>
+///   sink.<sink>.buffer_size = <characters>
+///   sink.<sink>.spill_limit = <characters>
+///   sink.<sink>.rotate_size = <bytes>
+///   sink.<sink>.rotate_keep = <files>
+///   sink.<sink>.batch_size = <characters>
+///   sink.<sink>.batch_age = <ms>
+class config {
+  /// \brief Values by key
+  std::map<std::string, std::string, std::less<>> m_values{};
+
+ public:
+  /// \brief Parses configuration text, reporting malformed lines to the
+  /// error handler and skipping them
+  static config parse(std::istream& is);
+
+  /// \brief Returns the value of a key, nullptr if it is not set
+  std::string const* value(std::string_view key) const;
+
+  /// \brief Reads a logging level by name, case insensitive
+  /// \returns false if the key is not set or not a level
+  bool level(std::string_view key, log_level& lvl) const;
+
+  /// \brief Reads a stall policy by name, case insensitive
+  /// \returns false if the key is not set or not a stall policy
+  bool policy(std::string_view key, stall_policy& policy) const;
+
+  /// \brief Reads an unsigned decimal number
+  /// \returns false if the key is not set or not a number
+  bool number(std::string_view key, std::uint64_t& num) const;
+};  // ^ config ^
+
+/// \brief Loads a configuration file and applies it to loggers and sinks,
+/// again whenever the file changes
+/// \note Changes are detected with inotify on Linux and by polling the
+/// file's modification time elsewhere. Each loaded configuration is
+/// published with an atomic pointer swap, so reading it never locks or
+/// waits; a reload frees the replaced configuration once the reads that
+/// started before the swap have finished
+class config_watcher {
+ public:
+  /// \brief Applies a configuration to a target
+  /// \returns false once the target no longer exists
+  using applier = std::function<bool(config const&)>;
+
+ private:
+  /// \brief Watched configuration file
+  std::filesystem::path m_path;
+
+  /// \brief Interval between checks when polling
+  std::chrono::milliseconds m_interval;
+
+  /// \brief Current configuration
+  std::atomic<config const*> m_config_atm{nullptr};
+
+  /// \brief Number of reads of m_config_atm in progress, by the phase they
+  /// started in
+  std::array<std::atomic<std::size_t>, 2> mutable m_readers_atm{};
+
+  /// \brief Phase new reads are counted under, in its lowest bit
+  std::atomic<std::size_t> m_phase_atm{0};
+
+  /// \brief Mutex for m_appliers and m_stop
+  std::mutex mutable m_mtx{};
+
+  /// \brief Targets the configuration is applied to
+  std::vector<applier> m_appliers{};
+
+  /// \brief Wakes the watcher thread when stopping
+  std::condition_variable m_cv{};
+
+  /// \brief Pipe waking the watcher thread from poll when stopping
+  std::array<int, 2> m_wake{-1, -1};
+
+  /// \brief Set to stop the watcher thread
+  bool m_stop{false};
+
+  /// \brief Watcher thread
+  std::thread m_thread{};
+
+ public:
+  /// \brief Loads a configuration file and starts watching it
+  /// \param filepath Path of the configuration file
+  /// \param interval Interval between checks where inotify is unavailable
+  explicit config_watcher(
+      std::filesystem::path filepath,
+      std::chrono::milliseconds interval = std::chrono::seconds{1});
+
+  config_watcher(config_watcher const&) = delete;
+
+  config_watcher& operator=(config_watcher const&) = delete;
+
+  /// \brief Stops watching and frees every loaded configuration
+  ~config_watcher();
+
+  /// \brief Calls a function with the current configuration without
+  /// locking
+  /// \param fn Function taking config const&, which must not keep a
+  /// reference to it past the call or call reload()
+  /// \returns The result of fn
+  template <typename Fn>
+  decltype(auto) read(Fn&& fn) const {
+    // The count is raised before loading the pointer, so a reload waiting
+    // for the count to drain knows the read has let go of the pointer
+    struct reader {
+      std::atomic<std::size_t>& readers_atm;
+      ~reader() { readers_atm.fetch_sub(1); }
+    };
+    auto& readers_atm = m_readers_atm[m_phase_atm.load() & 1];
+    readers_atm.fetch_add(1);
+    auto const r = reader{readers_atm};
+    return std::forward<Fn>(fn)(*m_config_atm.load());
+  }
+
+  /// \brief Returns a copy of the current configuration
+  config current() const {
+    return read([](config const& cfg) { return cfg; });
+  }
+
+  /// \brief Applies "level" and "level.<name>" to a logger, which must
+  /// outlive the watcher
+  /// \param name Name the logger is configured by
+  /// \param logger Logger to configure
+  /// \returns *this
+  template <typename Logger>
+  config_watcher& add_logger(std::string name, Logger& logger) {
+    return add_applier([name = "level." + std::move(name),
+                        &logger](config const& cfg) {
+      auto lvl = log_level{};
+      if (cfg.level(name, lvl) || cfg.level("level", lvl))
+        logger.min_log_level(lvl);
+      return true;
+    });
+  }
+
+  /// \brief Applies the "sink.<name>." keys to a sink; the watcher does not
+  /// keep the sink alive
+  /// \param name Name the sink is configured by
+  /// \param sink Sink to configure
+  /// \returns *this
+  template <typename Sink>
+  config_watcher& add_sink(std::string name,
+                           std::shared_ptr<Sink> const& sink) {
+    return add_applier([prefix = "sink." + std::move(name) + '.',
+                        weak = std::weak_ptr<Sink>{sink}](config const& cfg) {
+      auto const target = weak.lock();
+      if (!target) return false;
+
+      auto num = std::uint64_t{};
+      auto policy = stall_policy{};
+      if (cfg.number(prefix + "stall_timeout", num))
+        target->stall_timeout(std::chrono::milliseconds(num));
+      if (cfg.policy(prefix + "on_stall", policy)) target->on_stall(policy);
+      if (cfg.number(prefix + "record_limit", num))
+        target->record_limit(std::size_t(num));
+      if (cfg.number(prefix + "buffer_size", num))
+        target->buffer_size(std::size_t(num));
+      if (cfg.number(prefix + "spill_limit", num))
+        target->spill_limit(std::size_t(num));
+      if (cfg.number(prefix + "rotate_size", num)) {
+        auto keep = std::uint64_t{5};
+        cfg.number(prefix + "rotate_keep", keep);
+        target->rotate(num, std::size_t(keep));
+      }
+      if (cfg.number(prefix + "batch_size", num)) {
+        auto age = std::uint64_t(target->batch_age().count());
+        cfg.number(prefix + "batch_age", age);
+        target->batch(std::size_t(num), std::chrono::milliseconds(age),
+                      target->batch_level());
+      }
+      if (auto const* file = cfg.value(prefix + "file")) {
+        auto const path = typename Sink::path_type{*file};
+        if (target->path() != path) target->switch_file(path);
+      }
+      return true;
+    });
+  }
+
+  /// \brief Adds a target the configuration is applied to, applying the
+  /// current configuration right away
+  /// \returns *this
+  config_watcher& add_applier(applier apply);
+
+  /// \brief Reads the configuration file, publishes it, and applies it
+  /// \returns false if the file cannot be read
+  bool reload();
+
+ private:
+  /// \brief Reloads the configuration whenever the file changes, until
+  /// stopped
+  /// \param notify_fd inotify descriptor watching the file's directory, -1
+  /// to poll the file instead
+  void run(int notify_fd);
+};  // ^ config_watcher ^
+
+namespace detail {
+
+/// \brief Opens a file for writing with O_APPEND
+/// \returns File descriptor, or -1 on failure
+int open_append(std::filesystem::path const& filepath) noexcept;
+
+/// \brief Closes a file descriptor opened with open_append
+void close_append(int fd) noexcept;
+
+/// \brief Writes a buffer with a single write call, retrying on EINTR and
+/// on partial writes
+/// \returns true on success
+bool write_append(int fd, void const* data, std::size_t size) noexcept;
+
+/// \brief Acquires or releases an exclusive advisory lock on a file
+/// \returns true on success
+bool lock_append(int fd, bool lock) noexcept;
+
+/// \brief gzip stream written to a file, defined in slug.cpp
+struct compressed_file;
+
+/// \brief Opens a file for appending a compressed stream
+/// \param level Compression level from 1 to 9, only used by gzip
+/// \param codec Compression codec
+/// \returns nullptr on failure, with errno set to ENOTSUP for gzip if slug
+/// was built without zlib
+compressed_file* open_compressed(std::filesystem::path const& filepath,
+                                 int level, compression_codec codec) noexcept;
+
+/// \brief Compresses a block and writes it so the file can be decompressed
+/// up to the end of the block even if the stream is never finished
+/// \returns true on success
+bool write_compressed(compressed_file* file, void const* data,
+                      std::size_t size) noexcept;
+
+/// \brief Finishes the compressed stream and closes the file
+/// \returns true on success
+bool close_compressed(compressed_file* file) noexcept;
+
+}  // namespace detail
+
+/// \brief Checks if slug was built with zlib and can write gzip files
+bool compression_supported() noexcept;
+
+/// \brief Decompresses a file written with compression_codec::Lz, decoding
+/// its blocks on several threads
+/// \param filepath Path to compressed file
+/// \param os Stream receiving the decompressed output
+/// \param threads Number of decoding threads, zero for one per hardware
+/// thread
+/// \returns false if the file cannot be read or holds a corrupt or
+/// incomplete block, after writing the blocks before it
+bool decompress_file(std::filesystem::path const& filepath, std::ostream& os,
+                     unsigned threads = 0);
+
+/// \brief std::basic_filebuf class whose pending output can be discarded
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class basic_logfilebuf : public std::basic_filebuf<CharT, Traits> {
+ public:
+  /// \brief Discards output not yet written to the file, such as a record
+  /// a failed write left behind
+  void discard() {
+    std::basic_filebuf<CharT, Traits>::setp(this->pbase(), this->epptr());
+  }
+};  // ^ basic_logfilebuf ^
+
+/// \brief std::basic_streambuf class that writes every record as a single
+/// O_APPEND write so records from several processes never interleave
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class basic_appendbuf : public std::basic_streambuf<CharT, Traits> {
+ public:
+  using streambuf_type = std::basic_streambuf<CharT, Traits>;
+  using int_type = typename Traits::int_type;
+  using path_type = std::filesystem::path;
+
+ private:
+  /// \brief Buffer holding the record being written
+  std::vector<CharT> m_buf{};
+
+  /// \brief Record buffer size kept between records
+  std::size_t m_capacity{256};
+
+  /// \brief File descriptor, or -1 if closed
+  int m_fd{-1};
+
+  /// \brief Largest single write in bytes
+  std::size_t m_max_write{default_atomic_write};
+
+  /// \brief Handling of records larger than m_max_write
+  oversize_policy m_oversize{oversize_policy::Split};
+
+ public:
+  basic_appendbuf() = default;
+
+  basic_appendbuf(basic_appendbuf const&) = delete;
+
+  basic_appendbuf(basic_appendbuf&& rhs) { swap(rhs); }
+
+  basic_appendbuf& operator=(basic_appendbuf const&) = delete;
+
+  basic_appendbuf& operator=(basic_appendbuf&& rhs) {
+    close();
+    swap(rhs);
+    return *this;
+  }
+
+  virtual ~basic_appendbuf() { close(); }
+
+  /// \brief Checks if a file is open
+  bool is_open() const noexcept { return m_fd != -1; }
+
+  /// \brief Opens a file for appending
+  /// \param filepath Path to output file
+  /// \param max_write Largest single write in bytes
+  /// \param oversize Handling of records larger than max_write
+  /// \returns this on success, nullptr otherwise
+  basic_appendbuf* open(
+      path_type const& filepath,
+      std::size_t const max_write = default_atomic_write,
+      oversize_policy const oversize = oversize_policy::Split) {
+    if (is_open()) return nullptr;
+
+    m_fd = detail::open_append(filepath);
+    if (m_fd == -1) return nullptr;
+
+    m_max_write = std::max(max_write, sizeof(CharT));
+    m_oversize = oversize;
+    resize_buffer(m_capacity);
+
+    return this;
+  }
+
+  /// \brief Writes pending output and closes the file
+  /// \returns this on success, nullptr otherwise
+  basic_appendbuf* close() {
+    if (!is_open()) return nullptr;
+
+    auto const ok = sync() == 0;
+    detail::close_append(m_fd);
+    m_fd = -1;
+    streambuf_type::setp(nullptr, nullptr);
+    std::vector<CharT>{}.swap(m_buf);
+
+    return ok ? this : nullptr;
+  }
+
+  /// \brief Sets the record buffer size kept between records, growing the
+  /// buffer immediately and shrinking it once the current record is written
+  /// \param size Buffer size in characters
+  void capacity(std::size_t const size) {
+    m_capacity = size;
+    if (is_open() && size > m_buf.size()) resize_buffer(size);
+  }
+
+  /// \brief Returns the record buffer size kept between records
+  auto capacity() const noexcept { return m_capacity; }
+
+  /// \brief Returns the largest single write in bytes
+  auto max_write() const noexcept { return m_max_write; }
+
+  /// \brief Returns the handling of records larger than max_write()
+  auto oversize() const noexcept { return m_oversize; }
+
+  /// \brief Returns the memory held by the record buffer in bytes
+  auto memory_used() const noexcept { return m_buf.capacity() * sizeof(CharT); }
+
+  /// \brief Swap implementation
+  void swap(basic_appendbuf& rhs) {
+    streambuf_type::swap(rhs);
+    std::swap(m_buf, rhs.m_buf);
+    std::swap(m_capacity, rhs.m_capacity);
+    std::swap(m_fd, rhs.m_fd);
+    std::swap(m_max_write, rhs.m_max_write);
+    std::swap(m_oversize, rhs.m_oversize);
+  }
+
+ protected:
+  /// \brief Grows the record buffer, records are only written on sync
+  int_type overflow(int_type const ch) override {
+    if (!is_open()) return Traits::eof();
+
+    resize_buffer(std::max<std::size_t>(m_buf.size() * 2, 64));
+
+    if (Traits::eq_int_type(ch, Traits::eof())) return Traits::not_eof(ch);
+    return streambuf_type::sputc(Traits::to_char_type(ch));
+  }
+
+  /// \brief Writes the buffered record
+  int sync() override {
+    if (!is_open()) return -1;
+
+    auto const* const data = streambuf_type::pbase();
+    auto const size = static_cast<std::size_t>(streambuf_type::pptr() - data);
+    auto const ok = write_record(data, size);
+
+    streambuf_type::setp(m_buf.data(), m_buf.data() + m_buf.size());
+    if (m_buf.size() > m_capacity) {
+      resize_buffer(m_capacity);
+    }
+
+    return ok ? 0 : -1;
+  }
+
+ private:
+  /// \brief Resizes the record buffer, keeping any pending output
+  void resize_buffer(std::size_t const size) {
+    auto const used = streambuf_type::pptr() - streambuf_type::pbase();
+    detail::resize_exact(m_buf, std::max<std::size_t>(size, used));
+    streambuf_type::setp(m_buf.data(), m_buf.data() + m_buf.size());
+    streambuf_type::pbump(static_cast<int>(used));
+  }
+
+  /// \brief Writes one record, or the records of a batch, with as few
+  /// atomic writes as possible
+  bool write_record(CharT const* data, std::size_t size) const {
+    auto const max_chars = m_max_write / sizeof(CharT);
+
+    if (size <= max_chars) {
+      return size == 0 ||
+             detail::write_append(m_fd, data, size * sizeof(CharT));
+    }
+
+    if (m_oversize == oversize_policy::Lock) {
+      if (!detail::lock_append(m_fd, true)) return false;
+      auto const ok = detail::write_append(m_fd, data, size * sizeof(CharT));
+      return detail::lock_append(m_fd, false) && ok;
+    }
+
+    // Cut a batch between records so other writers cannot land inside one,
+    // and only a record larger than max_write on its own at max_write
+    for (; size > 0;) {
+      auto chunk = std::min(size, max_chars);
+      for (auto end = chunk; chunk < size && end > 0; --end) {
+        if (Traits::eq(data[end - 1], CharT('\n'))) {
+          chunk = end;
+          break;
+        }
+      }
+      if (!detail::write_append(m_fd, data, chunk * sizeof(CharT)))
+        return false;
+      data += chunk;
+      size -= chunk;
+    }
+
+    return true;
+  }
+};  // ^ basic_appendbuf ^
+
+/// \brief std::basic_streambuf class that compresses output to a file in
+/// blocks of a fixed size, each decodable without the blocks after it so a
+/// file cut short by a crash can still be decompressed up to its last whole
+/// block
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class basic_compressbuf : public std::basic_streambuf<CharT, Traits> {
+ public:
+  using streambuf_type = std::basic_streambuf<CharT, Traits>;
+  using int_type = typename Traits::int_type;
+  using path_type = std::filesystem::path;
+  using clock_type = std::chrono::steady_clock;
+
+ private:
+  /// \brief Buffer holding the block being filled
+  std::vector<CharT> m_buf{};
+
+  /// \brief Block size in characters
+  std::size_t m_block_size{default_compress_block};
+
+  /// \brief Compression level
+  int m_level{default_compress_level};
+
+  /// \brief Compression codec
+  compression_codec m_codec{compression_codec::Auto};
+
+  /// \brief Time the block being filled was started
+  clock_type::time_point m_block_begin{};
+
+  /// \brief Compressed file, or nullptr if closed
+  detail::compressed_file* m_file{nullptr};
+
+ public:
+  basic_compressbuf() = default;
+
+  basic_compressbuf(basic_compressbuf const&) = delete;
+
+  basic_compressbuf(basic_compressbuf&& rhs) { swap(rhs); }
+
+  basic_compressbuf& operator=(basic_compressbuf const&) = delete;
+
+  basic_compressbuf& operator=(basic_compressbuf&& rhs) {
+    close();
+    swap(rhs);
+    return *this;
+  }
+
+  virtual ~basic_compressbuf() { close(); }
+
+  /// \brief Checks if a file is open
+  bool is_open() const noexcept { return m_file != nullptr; }
+
+  /// \brief Opens a file for appending a compressed stream
+  /// \param filepath Path to output file
+  /// \param block_size Block size in characters
+  /// \param level Compression level from 1 to 9
+  /// \param codec Compression codec
+  /// \returns this on success, nullptr otherwise
+  basic_compressbuf* open(
+      path_type const& filepath,
+      std::size_t const block_size = default_compress_block,
+      int const level = default_compress_level,
+      compression_codec const codec = compression_codec::Auto) {
+    if (is_open()) return nullptr;
+
+    m_file = detail::open_compressed(filepath, level, codec);
+    if (m_file == nullptr) return nullptr;
+
+    m_block_size = std::max<std::size_t>(block_size, 1);
+    m_level = level;
+    m_codec = codec;
+    detail::resize_exact(m_buf, m_block_size);
+    start_block();
+
+    return this;
+  }
+
+  /// \brief Writes the pending block, finishes the stream and closes the
+  /// file
+  /// \returns this on success, nullptr otherwise
+  basic_compressbuf* close() {
+    if (!is_open()) return nullptr;
+
+    auto const written = write_block();
+    auto const closed = detail::close_compressed(m_file);
+    m_file = nullptr;
+    streambuf_type::setp(nullptr, nullptr);
+    std::vector<CharT>{}.swap(m_buf);
+
+    return written && closed ? this : nullptr;
+  }
+
+  /// \brief Compresses and writes the pending output as a block of its own
+  /// \returns true on success
+  bool flush_block() { return is_open() && write_block(); }
+
+  /// \brief Returns the block size in characters
+  auto block_size() const noexcept { return m_block_size; }
+
+  /// \brief Returns the compression level
+  auto level() const noexcept { return m_level; }
+
+  /// \brief Returns the compression codec
+  auto codec() const noexcept { return m_codec; }
+
+  /// \brief Returns the memory held by the block buffer in bytes
+  auto memory_used() const noexcept { return m_buf.capacity() * sizeof(CharT); }
+
+  /// \brief Swap implementation
+  void swap(basic_compressbuf& rhs) {
+    streambuf_type::swap(rhs);
+    std::swap(m_buf, rhs.m_buf);
+    std::swap(m_block_size, rhs.m_block_size);
+    std::swap(m_level, rhs.m_level);
+    std::swap(m_codec, rhs.m_codec);
+    std::swap(m_block_begin, rhs.m_block_begin);
+    std::swap(m_file, rhs.m_file);
+  }
+
+ protected:
+  /// \brief Writes the full block and starts the next one
+  int_type overflow(int_type const ch) override {
+    if (!is_open() || !write_block()) return Traits::eof();
+
+    if (Traits::eq_int_type(ch, Traits::eof())) return Traits::not_eof(ch);
+    return streambuf_type::sputc(Traits::to_char_type(ch));
+  }
+
+  /// \brief Writes the pending block once it is older than
+  /// compress_interval, as compressing every record on its own would
+  /// defeat compression
+  /// \note Only called as records are written, so a block started before
+  /// output went idle stays pending until the next record or flush_block
+  int sync() override {
+    if (!is_open()) return -1;
+    if (clock_type::now() - m_block_begin < compress_interval) return 0;
+    return write_block() ? 0 : -1;
+  }
+
+ private:
+  /// \brief Resets the put area for a new block
+  void start_block() {
+    streambuf_type::setp(m_buf.data(), m_buf.data() + m_buf.size());
+    m_block_begin = clock_type::now();
+  }
+
+  /// \brief Compresses and writes the pending output
+  /// \returns true on success
+  bool write_block() {
+    auto const* const data = streambuf_type::pbase();
+    auto const size = static_cast<std::size_t>(streambuf_type::pptr() - data);
+    auto const ok = size == 0 || detail::write_compressed(
+                                     m_file, data, size * sizeof(CharT));
+    start_block();
+    return ok;
+  }
+};  // ^ basic_compressbuf ^
+
+/// \brief std::ostream class for sending output to a file or console
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class basic_logstream : public std::basic_ostream<CharT, Traits> {
+ public:
+  using os_type = std::basic_ostream<CharT, Traits>;
+  using filebuf_type = basic_logfilebuf<CharT, Traits>;
+  using appendbuf_type = basic_appendbuf<CharT, Traits>;
+  using compressbuf_type = basic_compressbuf<CharT, Traits>;
+  using path_type = std::filesystem::path;
+
+ private:
+  /// \brief File buffer
+  filebuf_type m_filebuf{};
+
+  /// \brief Append buffer for files shared between processes
+  appendbuf_type m_appendbuf{};
+
+  /// \brief Buffer for compressed files
+  compressbuf_type m_compressbuf{};
+
+  /// \brief Storage for the file buffer
+  std::vector<CharT> m_buf{};
+
+  /// \brief File buffer size in characters
+  std::size_t m_buf_size{default_buffer_size};
+
+  /// \brief Path of the open file
+  path_type m_path{};
+
+  /// \brief Error of the last failed open
+  std::error_code m_error{};
+
+ public:
+  /// \brief Initialize basic_logstream for console output
+  basic_logstream() : os_type{std::clog.rdbuf()} {}
+
+  /// \brief Initialize basic_logstream for file output
+  /// \param filepath Path to output file
+  IMPLICIT basic_logstream(path_type const& filepath)
+      : os_type{std::clog.rdbuf()} {
+    open(filepath);
+  }
+
+  basic_logstream(basic_logstream const&) = delete;
+
+  basic_logstream(basic_logstream&& rhs) : basic_logstream{} { swap(rhs); }
+
+  basic_logstream& operator=(basic_logstream const&) = delete;
+
+  basic_logstream& operator=(basic_logstream&& rhs) {
+    close();
+    swap(rhs);
+    return *this;
+  }
+
+  virtual ~basic_logstream() { close(); }
+
+  /// \brief Checks if the file buffer's associated file is open
+  bool is_open() const {
+    return m_filebuf.is_open() || m_appendbuf.is_open() ||
+           m_compressbuf.is_open();
+  }
+
+  /// \brief Checks if the file was opened with open_shared
+  bool is_shared() const { return m_appendbuf.is_open(); }
+
+  /// \brief Checks if the file was opened with open_compressed
+  bool is_compressed() const { return m_compressbuf.is_open(); }
+
+  /// \brief Opens file for output
+  /// \param filepath Path to output file
+  /// \returns *this
+  IMPLICIT basic_logstream& open(path_type const& filepath) {
+    if (is_open()) close();
+
+    m_error.clear();
+    m_path = filepath;
+    open_filebuf();
+
+    os_type::flush();
+    os_type::rdbuf(&m_filebuf);
+
+    return *this;
+  }
+
+  /// \brief Opens a file shared with other processes for output, writing
+  /// each record as a single O_APPEND write of at most max_write bytes
+  /// \param filepath Path to output file
+  /// \param max_write Largest single write in bytes
+  /// \param oversize Handling of records larger than max_write
+  /// \returns *this
+  basic_logstream& open_shared(
+      path_type const& filepath,
+      std::size_t const max_write = default_atomic_write,
+      oversize_policy const oversize = oversize_policy::Split) {
+    if (is_open()) close();
+
+    m_error.clear();
+    m_path = filepath;
+    errno = 0;
+    if (auto&& buf = m_appendbuf.open(filepath, max_write, oversize);
+        buf == nullptr) {
+      m_error = detail::last_error();
+      os_type::setstate(std::ios::failbit);
+    }
+
+    os_type::flush();
+    os_type::rdbuf(&m_appendbuf);
+
+    return *this;
+  }
+
+  /// \brief Opens a file for compressed output, appending to an existing
+  /// file
+  /// \param filepath Path to output file
+  /// \param block_size Size of independently compressed blocks in
+  /// characters
+  /// \param level Compression level from 1 to 9
+  /// \param codec Compression codec
+  /// \returns *this
+  basic_logstream& open_compressed(
+      path_type const& filepath,
+      std::size_t const block_size = default_compress_block,
+      int const level = default_compress_level,
+      compression_codec const codec = compression_codec::Auto) {
+    if (is_open()) close();
+
+    m_error.clear();
+    m_path = filepath;
+    errno = 0;
+    if (auto&& buf = m_compressbuf.open(filepath, block_size, level, codec);
+        buf == nullptr) {
+      m_error = detail::last_error();
+      os_type::setstate(std::ios::failbit);
+    }
+
+    os_type::flush();
+    os_type::rdbuf(&m_compressbuf);
+
+    return *this;
+  }
+
+  /// \brief Closes the file buffer if open and switches to console output
+  /// \returns *this
+  basic_logstream& close() {
+    os_type::flush();
+
+    if (is_open()) {
+      m_filebuf.close();
+      m_appendbuf.close();
+      m_compressbuf.close();
+      os_type::rdbuf(std::clog.rdbuf());
+    }
+
+    std::vector<CharT>{}.swap(m_buf);
+
+    return *this;
+  }
+
+  /// \brief Reopens the open file in the same mode after a write error, or
+  /// only clears the error state for console output
+  /// \note Output still pending in the file buffer is discarded, as it is
+  /// the output that failed to be written and the caller holds on to it
+  /// \returns *this
+  basic_logstream& reopen() {
+    os_type::clear();
+
+    if (m_filebuf.is_open()) {
+      m_filebuf.discard();
+      m_filebuf.close();
+      m_error.clear();
+      open_filebuf();
+    } else if (m_appendbuf.is_open()) {
+      auto const max_write = m_appendbuf.max_write();
+      auto const oversize = m_appendbuf.oversize();
+      m_appendbuf.close();
+      m_error.clear();
+      errno = 0;
+      if (m_appendbuf.open(m_path, max_write, oversize) == nullptr) {
+        m_error = detail::last_error();
+        os_type::setstate(std::ios::failbit);
+      }
+    } else if (m_compressbuf.is_open()) {
+      auto const block_size = m_compressbuf.block_size();
+      auto const level = m_compressbuf.level();
+      auto const codec = m_compressbuf.codec();
+      m_compressbuf.close();
+      m_error.clear();
+      errno = 0;
+      if (m_compressbuf.open(m_path, block_size, level, codec) == nullptr) {
+        m_error = detail::last_error();
+        os_type::setstate(std::ios::failbit);
+      }
+    }
+
+    return *this;
+  }
+
+  /// \brief Flushes the stream, ending the pending block of a compressed
+  /// file so it can be decompressed up to this point
+  /// \returns *this
+  basic_logstream& flush_block() {
+    os_type::flush();
+    if (m_compressbuf.is_open() && !m_compressbuf.flush_block())
+      os_type::setstate(std::ios::badbit);
+    return *this;
+  }
+
+  /// \brief Sets the output buffer size, flushing and replacing the current
+  /// file buffer if a file is open
+  /// \param size Buffer size in characters
+  /// \returns *this
+  basic_logstream& buffer_size(std::size_t const size) {
+    m_buf_size = size;
+    m_appendbuf.capacity(size);
+
+    if (m_filebuf.is_open() && size != m_buf.size()) {
+      os_type::flush();
+      m_filebuf.close();
+      open_filebuf();
+    }
+
+    return *this;
+  }
+
+  /// \brief Returns the output buffer size in characters
+  auto buffer_size() const noexcept { return m_buf_size; }
+
+  /// \brief Returns the largest single write of shared files in bytes
+  auto max_write() const noexcept { return m_appendbuf.max_write(); }
+
+  /// \brief Returns the handling of records larger than max_write() in
+  /// shared files
+  auto oversize() const noexcept { return m_appendbuf.oversize(); }
+
+  /// \brief Returns the block size of compressed files in characters
+  auto compressed_block_size() const noexcept {
+    return m_compressbuf.block_size();
+  }
+
+  /// \brief Returns the compression level of compressed files
+  auto compression_level() const noexcept { return m_compressbuf.level(); }
+
+  /// \brief Returns the compression codec of compressed files
+  auto codec() const noexcept { return m_compressbuf.codec(); }
+
+  /// \brief Returns the error of the last failed open, if any
+  auto const& error() const noexcept { return m_error; }
+
+  /// \brief Returns the memory held by the output buffers in bytes
+  auto memory_used() const noexcept {
+    return m_buf.capacity() * sizeof(CharT) + m_appendbuf.memory_used() +
+           m_compressbuf.memory_used();
+  }
+
+  /// \brief Swap implementation
+  void swap(basic_logstream& rhs) {
+    if (this != std::addressof(rhs)) {
+      auto* const buf = os_type::rdbuf();
+      auto* const rhs_buf = rhs.rdbuf();
+      os_type::swap(rhs);
+      m_filebuf.swap(rhs.m_filebuf);
+      m_appendbuf.swap(rhs.m_appendbuf);
+      m_compressbuf.swap(rhs.m_compressbuf);
+      std::swap(m_buf, rhs.m_buf);
+      std::swap(m_buf_size, rhs.m_buf_size);
+      std::swap(m_path, rhs.m_path);
+      std::swap(m_error, rhs.m_error);
+      adopt_rdbuf(rhs_buf, rhs);
+      rhs.adopt_rdbuf(buf, *this);
+    }
+  }
+
+ private:
+  /// \brief Opens m_path through the file buffer using a buffer of
+  /// m_buf_size characters
+  void open_filebuf() {
+    constexpr auto flags = std::ios::binary | std::ios::out | std::ios::app;
+
+    detail::resize_exact(m_buf, std::max<std::size_t>(m_buf_size, 1));
+    m_filebuf.pubsetbuf(m_buf.data(),
+                        static_cast<std::streamsize>(m_buf.size()));
+
+    errno = 0;
+    if (auto&& buf = m_filebuf.open(m_path, flags); buf == nullptr) {
+      m_error = detail::last_error();
+      os_type::setstate(std::ios::failbit);
+    }
+  }
+
+  /// \brief Switches to the stream buffer of other swapped into this
+  /// stream, or to buf itself if other does not own it, keeping the stream
+  /// state
+  void adopt_rdbuf(std::basic_streambuf<CharT, Traits>* buf,
+                   basic_logstream const& other) {
+    if (buf == &other.m_filebuf) {
+      buf = &m_filebuf;
+    } else if (buf == &other.m_appendbuf) {
+      buf = &m_appendbuf;
+    } else if (buf == &other.m_compressbuf) {
+      buf = &m_compressbuf;
+    }
+
+    auto const state = os_type::rdstate();
+    os_type::rdbuf(buf);
+    os_type::clear(state);
+  }
+};  // ^ basic_logstream ^
+
+/// \brief basic_logstream swap specialization
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+void swap(basic_logstream<CharT, Traits>& lhs,
+          basic_logstream<CharT, Traits>& rhs) {
+  lhs.swap(rhs);
+}
+
+using logstream = basic_logstream<char>;
+using wlogstream = basic_logstream<wchar_t>;
+using u16logstream = basic_logstream<char16_t>;
+using u32logstream = basic_logstream<char32_t>;
+
+namespace detail {
+
+/// \brief Checks if enumeration E has a fixed underlying type, which every
+/// scoped enumeration has, so that any value of that type is a valid E
+template <typename E, typename = void>
+struct has_fixed_underlying_type : std::false_type {};
+
+template <typename E>
+struct has_fixed_underlying_type<
+    E, std::void_t<decltype(E{std::underlying_type_t<E>{}})>>
+    : std::true_type {};
+
+}  // namespace detail
+
+/// \brief Range of enumerator values whose names are known to enum_name
+/// \tparam E Enumeration type, specialize to cover other values
+/// \note The range is empty for unscoped enumerations without a fixed
+/// underlying type, as casting a value outside their enumerators' bit
+/// range is undefined; a specialization for such E must stay within it
+template <typename E>
+struct enum_range {
+  static constexpr auto const fixed =
+      detail::has_fixed_underlying_type<E>::value;
+  static constexpr auto const min =
+      fixed && std::is_signed_v<std::underlying_type_t<E>> ? -16 : 0;
+  static constexpr auto const max = fixed ? 63 : -1;
+};
+
+namespace detail {
+
+/// \brief Extracts the unqualified name of enumerator V from the compiler's
+/// function signature
+/// \returns Enumerator name, or an empty string_view if V is unnamed
+template <auto V>
+constexpr std::string_view enum_value_name() noexcept {
+#if defined(__clang__) || defined(__GNUC__)
+  // "... enum_value_name() [with auto V = ns::color::red; ...]" (GCC)
+  // "... enum_value_name() [V = ns::color::red]" (Clang)
+  auto const sig = std::string_view{__PRETTY_FUNCTION__};
+  auto const begin = sig.find("V = ") + 4;
+  auto const end = sig.find_first_of(";]", begin);
+#elif defined(_MSC_VER)
+  // "... enum_value_name<ns::color::red>(void) noexcept"
+  auto const sig = std::string_view{__FUNCSIG__};
+  auto const begin = sig.find("enum_value_name<") + 16;
+  auto const end = sig.rfind(">(");
+#else
+  auto const sig = std::string_view{};
+  auto const begin = std::size_t{0};
+  auto const end = std::size_t{0};
+#endif
+  auto const name = sig.substr(begin, end - begin);
+
+  // Values without an enumerator are spelled as casts, e.g. "(color)5"
+  if (name.empty() || name.front() == '(' || name.front() == '-' ||
+      (name.front() >= '0' && name.front() <= '9'))
+    return {};
+
+  return name.substr(name.rfind(':') + 1);
+}
+
+/// \brief Builds the table of enumerator names covered by enum_range<E>
+template <typename E, int... Is>
+constexpr auto make_enum_names(std::integer_sequence<int, Is...>) noexcept {
+  return std::array<std::string_view, sizeof...(Is)>{
+      enum_value_name<static_cast<E>(enum_range<E>::min + Is)>()...};
+}
+
+/// \brief Enumerator names of E indexed by value - enum_range<E>::min
+template <typename E>
+inline constexpr auto const enum_names = make_enum_names<E>(
+    std::make_integer_sequence<int, enum_range<E>::max - enum_range<E>::min +
+                                        1>{});
+
+/// \brief Checks if T can be written to OStream with operator<<
+template <typename OStream, typename T, typename = void>
+struct is_streamable : std::false_type {};
+
+template <typename OStream, typename T>
+struct is_streamable<OStream, T,
+                     std::void_t<decltype(std::declval<OStream&>()
+                                          << std::declval<T const&>())>>
+    : std::true_type {};
+
+/// \brief Enumeration value written by name
+template <typename E>
+struct enum_text {
+  E value;
+};
+
+/// \brief Passes a message through unchanged, except enumerations without a
+/// stream operator which are written by name
+template <typename OStream, typename T>
+constexpr decltype(auto) loggable(T&& msg) noexcept {
+  using value_type = std::decay_t<T>;
+  if constexpr (std::is_enum_v<value_type> &&
+                !is_streamable<OStream, value_type>::value)
+    return enum_text<value_type>{msg};
+  else
+    return std::forward<T>(msg);
+}
+
+}  // namespace detail
+
+/// \brief Returns the name of an enumerator with a single table lookup
+/// \param value Enumeration value
+/// \returns Enumerator name, or an empty string_view if value is unnamed or
+/// outside enum_range<E>
+template <typename E>
+constexpr std::string_view enum_name(E const value) noexcept {
+  using range = enum_range<E>;
+  auto const& names = detail::enum_names<E>;
+  auto const index = static_cast<long long>(value) - range::min;
+  if (index < 0 || index >= static_cast<long long>(names.size())) return {};
+  return names[static_cast<std::size_t>(index)];
+}
+
+namespace detail {
+
+/// \brief Writes an enumeration value by name, or as an integer if unnamed
+template <typename CharT, typename Traits, typename E>
+std::basic_ostream<CharT, Traits>& operator<<(
+    std::basic_ostream<CharT, Traits>& os, detail::enum_text<E> const& text) {
+  auto const name = enum_name(text.value);
+  if (name.empty())
+    return os << +static_cast<std::underlying_type_t<E>>(text.value);
+
+  if constexpr (std::is_same_v<CharT, char>) {
+    os.write(name.data(), static_cast<std::streamsize>(name.size()));
+  } else {
+    for (auto const ch : name) os.put(os.widen(ch));
+  }
+  return os;
+}
+
+}  // namespace detail
+
+/// \brief Key of a structured field, checked once when constructed
+class field_key {
+  /// \brief Key as given
+  std::string_view m_name;
+
+  /// \brief Set if the key can be written as is in logfmt
+  bool m_plain;
+
+ public:
+  /// \brief Checks if a character can appear in a logfmt key unchanged
+  static constexpr bool is_plain(char const ch) noexcept {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+           (ch >= '0' && ch <= '9') || ch == '_' || ch == '.' || ch == '-' ||
+           ch == '/';
+  }
+
+  IMPLICIT constexpr field_key(char const* const name) noexcept
+      : field_key{std::string_view{name}} {}
+
+  IMPLICIT constexpr field_key(std::string_view const name) noexcept
+      : m_name{name}, m_plain{!name.empty()} {
+    for (auto const ch : name) m_plain = m_plain && is_plain(ch);
+  }
+
+  /// \brief Returns the key as given
+  constexpr auto name() const noexcept { return m_name; }
+
+  /// \brief Checks if the key can be written as is in logfmt
+  constexpr auto plain() const noexcept { return m_plain; }
+
+  /// \brief Writes the key, replacing characters logfmt does not allow in
+  /// keys with '_'
+  template <typename OStream>
+  void write(OStream& os) const {
+    if (m_name.empty()) {
+      os << '_';
+    } else {
+      for (auto const ch : m_name) os << (m_plain || is_plain(ch) ? ch : '_');
+    }
+  }
+};  // ^ field_key ^
+
+namespace detail {
+
+/// \brief Key and value of a structured field
+template <typename T>
+struct field {
+  field_key key;
+  T const& value;
+};
+
+/// \brief Checks if T is a structured field
+template <typename T>
+struct is_field : std::false_type {};
+
+template <typename T>
+struct is_field<field<T>> : std::true_type {};
+
+/// \brief Writes a structured field as key=value in plain text records
+template <typename CharT, typename Traits, typename T>
+std::basic_ostream<CharT, Traits>& operator<<(
+    std::basic_ostream<CharT, Traits>& os, field<T> const& fld) {
+  fld.key.write(os);
+  return os << '=' << loggable<std::basic_ostream<CharT, Traits>>(fld.value);
+}
+
+}  // namespace detail
+
+/// \brief Creates a structured field, written as a separate key in logfmt
+/// records and as key=value in text records
+/// \param key Field key
+/// \param value Field value, referenced until the record is written
+template <typename T>
+constexpr auto field(field_key const key, T const& value) noexcept {
+  return detail::field<T>{key, value};
+}
+
+/// \brief Maximum number of frames captured by stack_trace
+static constexpr auto const max_stack_frames = std::size_t{32};
+
+namespace detail {
+
+/// \brief Captures the calling thread's return addresses
+/// \param frames Output array of return addresses
+/// \param max_frames Size of the output array
+/// \param skip Number of innermost frames to skip besides this function
+/// \returns Number of captured frames
+std::size_t capture_stack(void** frames, std::size_t max_frames,
+                          std::size_t skip) noexcept;
+
+/// \brief Returns a description of a code address, resolving and caching it
+/// on first use; cached addresses take only a shared lock
+std::string const& symbolize(void const* addr);
+
+}  // namespace detail
+
+/// \brief Call stack captured as raw return addresses, which are only
+/// symbolized when the trace is written to a stream
+/// \note A logger writes the trace while formatting the record, so the
+/// addresses are symbolized on the logging thread before the sink's stream
+/// mutex is taken; resolved addresses are cached process-wide, so only the
+/// first trace through a frame pays for the symbol lookup
+/// \note Symbols of the executable itself are only resolved when it exports
+/// them (-rdynamic), otherwise frames are written as module+offset
+class stack_trace {
+  /// \brief Captured return addresses
+  std::array<void*, max_stack_frames> m_frames{};
+
+  /// \brief Number of captured return addresses
+  std::size_t m_size{};
+
+ public:
+  /// \brief Captures the current call stack
+  /// \param skip Number of innermost frames to skip
+  explicit stack_trace(std::size_t const skip = 0) noexcept
+      : m_size{detail::capture_stack(m_frames.data(), m_frames.size(),
+                                     skip)} {}
+
+  /// \brief Returns the number of captured frames
+  constexpr auto size() const noexcept { return m_size; }
+
+  /// \brief Returns an iterator to the innermost frame
+  constexpr auto begin() const noexcept { return m_frames.begin(); }
+
+  /// \brief Returns an iterator past the outermost frame
+  constexpr auto end() const noexcept { return m_frames.begin() + m_size; }
+};  // ^ stack_trace ^
+
+/// \brief Writes one symbolized line per captured frame
+template <typename CharT, typename Traits>
+std::basic_ostream<CharT, Traits>& operator<<(
+    std::basic_ostream<CharT, Traits>& os, stack_trace const& frames) {
+  auto frame = 0;
+  for (auto const* addr : frames) {
+    os << "\n  #" << frame++ << ' ' << detail::symbolize(addr).c_str();
+  }
+  return os;
+}
+
+/// \brief Size of a record written by signal_safe_log, including the
+/// trailing newline
+static constexpr auto const signal_record_size = std::size_t{256};
+
+namespace detail {
+
+/// \brief Claims a record buffer of signal_record_size bytes from a fixed
+/// pool, using only lock-free atomics
+/// \returns Record buffer, or nullptr if every buffer is in use
+char* acquire_signal_record() noexcept;
+
+/// \brief Returns a record buffer to the pool
+void release_signal_record(char* record) noexcept;
+
+/// \brief Writes a record to the signal-safe output with write(2), leaving
+/// errno unchanged
+void write_signal_record(char const* record, std::size_t size) noexcept;
+
+/// \brief Checks if signal_safe_log can format a message of type T
+template <typename T>
+inline constexpr auto const is_signal_safe =
+    std::is_integral_v<T> || std::is_enum_v<T> ||
+    std::is_same_v<T, char const*> || std::is_same_v<T, char*>;
+
+/// \brief Record formatted into a fixed-size buffer without allocating
+class signal_record {
+  char* const m_buf;
+  std::size_t m_size{0};
+
+ public:
+  explicit signal_record(char* const buf) noexcept : m_buf{buf} {}
+
+  /// \brief Returns the number of characters written
+  constexpr auto size() const noexcept { return m_size; }
+
+  /// \brief Appends characters, truncating at the end of the buffer while
+  /// keeping room for the trailing newline
+  void append(char const* str, std::size_t len) noexcept {
+    len = std::min(len, signal_record_size - 1 - m_size);
+    for (auto i = std::size_t{0}; i < len; ++i) m_buf[m_size++] = str[i];
+  }
+
+  /// \brief Appends a NUL-terminated string
+  void append(char const* const str) noexcept {
+    if (str == nullptr) return append("(null)");
+    auto len = std::size_t{0};
+    while (str[len] != '\0') ++len;
+    append(str, len);
+  }
+
+  /// \brief Appends a message
+  template <typename T>
+  void append_msg(T const& msg) noexcept {
+    if constexpr (std::is_same_v<T, bool>) {
+      append(msg ? "1" : "0", 1);
+    } else if constexpr (std::is_same_v<T, char>) {
+      append(&msg, 1);
+    } else if constexpr (std::is_enum_v<T>) {
+      if (auto const name = enum_name(msg); !name.empty())
+        append(name.data(), name.size());
+      else
+        append_msg(static_cast<std::underlying_type_t<T>>(msg));
+    } else if constexpr (std::is_integral_v<T>) {
+      // Digits are generated from the least significant end, negating each
+      // remainder so the most negative value needs no special case
+      char digits[24];
+      auto pos = sizeof(digits);
+      auto value = msg;
+      do {
+        auto const digit = value % 10;
+        digits[--pos] = static_cast<char>('0' + (digit < 0 ? -digit : digit));
+        value /= 10;
+      } while (value != 0);
+      if (msg < 0) digits[--pos] = '-';
+      append(digits + pos, sizeof(digits) - pos);
+    } else {
+      append(msg);
+    }
+  }
+
+  /// \brief Terminates the record with a newline
+  void finish() noexcept { m_buf[m_size++] = '\n'; }
+};  // ^ signal_record ^
+
+}  // namespace detail
+
+/// \brief Sets the file descriptor signal_safe_log writes to, stderr by
+/// default
+void signal_safe_fd(int fd) noexcept;
+
+/// \brief Returns the number of records signal_safe_log dropped because
+/// every record buffer was in use
+std::uint64_t signal_safe_dropped() noexcept;
+
+/// \brief Logs message(s) from a signal handler or other context where
+/// locks and allocation are unavailable; the record is formatted into a
+/// pre-sized buffer claimed with atomics and written with write(2)
+/// \note Only integers, characters, enumerations, and strings are accepted,
+/// records are truncated to signal_record_size characters
+/// \tparam Ts Template parameter pack of message types
+/// \param lvl Logging level written with the record
+/// \param msgs Function parameter pack of messages to log
+template <typename... Ts>
+void signal_safe_log(log_level const lvl, Ts const&... msgs) noexcept {
+  static_assert((detail::is_signal_safe<std::decay_t<Ts const>> && ...),
+                "signal_safe_log only formats integers, characters, "
+                "enumerations, and strings");
+
+  auto* const buf = detail::acquire_signal_record();
+  if (buf == nullptr) return;
+
+  static constexpr char const* const labels[] = {
+      "[signal] TRACE: ", "[signal] INFO:  ", "[signal] WARN:  ",
+      "[signal] ERROR: ", "[signal] FATAL: ", "[signal] "};
+
+  auto record = detail::signal_record{buf};
+  record.append(labels[std::min(static_cast<std::size_t>(lvl),
+                                std::size(labels) - 1)]);
+  (record.append_msg(static_cast<std::decay_t<Ts const>>(msgs)), ...);
+  record.finish();
+
+  detail::write_signal_record(buf, record.size());
+  detail::release_signal_record(buf);
+}
+
+namespace detail {
+
+/// \brief std::basic_streambuf class collecting a single record in memory
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class basic_recordbuf : public std::basic_streambuf<CharT, Traits> {
+ public:
+  using streambuf_type = std::basic_streambuf<CharT, Traits>;
+  using int_type = typename Traits::int_type;
+  using view_type = std::basic_string_view<CharT, Traits>;
+
+  /// \brief Buffer size kept between records in characters
+  static constexpr auto const initial_capacity = std::size_t{256};
+
+  /// \brief Number of records in a row fitting in initial_capacity after
+  /// which a grown buffer shrinks back to it
+  static constexpr auto const shrink_after = std::size_t{64};
+
+  /// \brief Largest buffer size in characters kept after a record
+  static constexpr auto const max_kept = std::size_t{64 * 1024};
+
+ private:
+  /// \brief Buffer holding the record
+  std::vector<CharT> m_buf{};
+
+  /// \brief Maximum record size in characters
+  std::size_t m_limit{no_limit};
+
+  /// \brief Characters discarded because of m_limit
+  std::size_t m_discarded{0};
+
+  /// \brief Records in a row that fit in initial_capacity since the buffer
+  /// grew beyond it
+  std::size_t m_small_records{0};
+
+ public:
+  /// \brief Record size limit meaning no limit
+  static constexpr auto const no_limit = ~std::size_t{0};
+
+  basic_recordbuf() { resize_buffer(initial_capacity); }
+
+  basic_recordbuf(basic_recordbuf const&) = delete;
+
+  basic_recordbuf& operator=(basic_recordbuf const&) = delete;
+
+  virtual ~basic_recordbuf() {
+    count_record_bytes(-static_cast<std::ptrdiff_t>(memory_used()));
+  }
+
+  /// \brief Returns the record written so far
+  view_type view() const noexcept {
+    return {streambuf_type::pbase(),
+            static_cast<std::size_t>(streambuf_type::pptr() -
+                                     streambuf_type::pbase())};
+  }
+
+  /// \brief Discards the record and its size limit, shrinking a grown
+  /// buffer once it exceeds max_kept or shrink_after small records in a row
+  /// show that the large records have stopped
+  void clear() {
+    auto const last = used();
+    m_limit = no_limit;
+    m_discarded = 0;
+    streambuf_type::setp(m_buf.data(), m_buf.data() + m_buf.size());
+    if (m_buf.size() <= initial_capacity) return;
+
+    m_small_records = last <= initial_capacity ? m_small_records + 1 : 0;
+    if (m_small_records >= shrink_after || m_buf.size() > max_kept) {
+      m_small_records = 0;
+      resize_buffer(initial_capacity);
+    }
+  }
+
+  /// \brief Sets the maximum record size, characters written beyond it are
+  /// discarded and counted
+  /// \param size Limit in characters, no_limit to lift it
+  void limit(std::size_t const size) {
+    m_limit = std::max<std::size_t>(size, used());
+    resize_buffer(m_buf.size());
+  }
+
+  /// \brief Returns the number of characters discarded because of the
+  /// record size limit
+  constexpr auto discarded() const noexcept { return m_discarded; }
+
+  /// \brief Discards the end of the record
+  /// \param size Number of characters kept
+  void truncate(std::size_t const size) noexcept {
+    streambuf_type::pbump(-static_cast<int>(used() - std::min(size, used())));
+  }
+
+  /// \brief Returns the memory held by the record buffer in bytes
+  auto memory_used() const noexcept { return m_buf.capacity() * sizeof(CharT); }
+
+  /// \brief Returns the memory held by the record buffers of all threads
+  /// in bytes
+  static auto used_bytes() noexcept { return record_bytes(); }
+
+ protected:
+  /// \brief Grows the record buffer, or discards the character once the
+  /// record size limit is reached
+  int_type overflow(int_type const ch) override {
+    if (Traits::eq_int_type(ch, Traits::eof())) return Traits::not_eof(ch);
+
+    if (used() >= m_limit) {
+      ++m_discarded;
+      return ch;
+    }
+
+    resize_buffer(m_buf.size() * 2);
+    return streambuf_type::sputc(Traits::to_char_type(ch));
+  }
+
+  /// \brief Writes a sequence of characters, growing the buffer at most once
+  /// and discarding whatever exceeds the record size limit
+  std::streamsize xsputn(CharT const* const str,
+                         std::streamsize const count) override {
+    auto const size = static_cast<std::size_t>(count);
+    auto const room = m_limit - used();
+    auto const fits = std::min(size, room);
+
+    if (fits > static_cast<std::size_t>(streambuf_type::epptr() -
+                                        streambuf_type::pptr())) {
+      resize_buffer(std::max(m_buf.size() * 2, used() + fits));
+    }
+
+    Traits::copy(streambuf_type::pptr(), str, fits);
+    streambuf_type::pbump(static_cast<int>(fits));
+    m_discarded += size - fits;
+    return count;
+  }
+
+ private:
+  /// \brief Returns the number of characters written so far
+  std::size_t used() const noexcept {
+    return static_cast<std::size_t>(streambuf_type::pptr() -
+                                    streambuf_type::pbase());
+  }
+
+  /// \brief Resizes the record buffer, keeping the record written so far,
+  /// and ends the put area at the record size limit
+  void resize_buffer(std::size_t const size) {
+    auto const used = this->used();
+    auto const before = memory_used();
+
+    detail::resize_exact(m_buf, std::max(size, used));
+    streambuf_type::setp(m_buf.data(),
+                         m_buf.data() + std::min(m_buf.size(), m_limit));
+    streambuf_type::pbump(static_cast<int>(used));
+
+    if (memory_used() != before) {
+      count_record_bytes(static_cast<std::ptrdiff_t>(memory_used()) -
+                         static_cast<std::ptrdiff_t>(before));
+    }
+  }
+};  // ^ basic_recordbuf ^
+
+/// \brief std::ostream class formatting a single record in memory
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class basic_recordstream : public std::basic_ostream<CharT, Traits> {
+ public:
+  using os_type = std::basic_ostream<CharT, Traits>;
+  using recordbuf_type = basic_recordbuf<CharT, Traits>;
+
+ private:
+  /// \brief Record buffer
+  recordbuf_type m_recordbuf{};
+
+  /// \brief Set while a record is being formatted
+  bool m_busy{false};
+
+ public:
+  basic_recordstream() : os_type{&m_recordbuf} {}
+
+  /// \brief Returns the record written so far
+  auto view() const noexcept { return m_recordbuf.view(); }
+
+  /// \brief Sets the maximum record size
+  /// \param size Limit in characters, recordbuf_type::no_limit to lift it
+  void limit(std::size_t const size) { m_recordbuf.limit(size); }
+
+  /// \brief Returns the number of characters discarded because of the
+  /// record size limit
+  auto discarded() const noexcept { return m_recordbuf.discarded(); }
+
+  /// \brief Discards the end of the record
+  /// \param size Number of characters kept
+  void truncate(std::size_t const size) noexcept { m_recordbuf.truncate(size); }
+
+  /// \brief Quotes and escapes the end of the record as a logfmt value if
+  /// it is empty or contains spaces, quotes, '=', '\\', or control
+  /// characters; other values are left as written
+  /// \param pos Position the value starts at
+  void quote_from(std::size_t const pos) {
+    auto const value = view().substr(pos);
+    auto const special = [](CharT const ch) {
+      return needs_escape(ch) || Traits::eq(ch, CharT(' ')) ||
+             Traits::eq(ch, CharT('=')) || Traits::eq(ch, CharT(0x7f));
+    };
+    if (!value.empty() && std::none_of(value.begin(), value.end(), special))
+      return;
+
+    auto const text = std::basic_string<CharT, Traits>{value};
+    truncate(pos);
+    os_type::put(CharT('"'));
+    for (auto const ch : text) put_escaped(ch);
+    os_type::put(CharT('"'));
+  }
+
+  /// \brief Escapes the end of the record as the contents of a JSON string
+  /// if it contains quotes, '\\', or control characters
+  /// \param pos Position the string contents start at
+  void escape_from(std::size_t const pos) {
+    auto const value = view().substr(pos);
+    if (std::none_of(value.begin(), value.end(), needs_escape)) return;
+
+    auto const text = std::basic_string<CharT, Traits>{value};
+    truncate(pos);
+    for (auto const ch : text) put_escaped(ch);
+  }
+
+  /// \brief Discards the record and restores default formatting
+  void clear() {
+    m_recordbuf.clear();
+    os_type::clear();
+    reset_format();
+  }
+
+  /// \brief Restores default formatting
+  void reset_format() {
+    os_type::flags(std::ios_base::skipws | std::ios_base::dec);
+    os_type::precision(6);
+    os_type::width(0);
+    os_type::fill(os_type::widen(' '));
+  }
+
+  /// \brief Returns the calling thread's record stream, or a new one if the
+  /// thread's stream is in use by a record that is still being formatted
+  class lease {
+    std::unique_ptr<basic_recordstream> m_owned{};
+    basic_recordstream* m_strm;
+
+   public:
+    lease() : m_strm{std::addressof(local())} {
+      if (m_strm->m_busy) {
+        m_owned = std::make_unique<basic_recordstream>();
+        m_strm = m_owned.get();
+      }
+      m_strm->m_busy = true;
+      m_strm->clear();
+    }
+
+    lease(lease const&) = delete;
+
+    lease& operator=(lease const&) = delete;
+
+    ~lease() { m_strm->m_busy = false; }
+
+    basic_recordstream& operator*() const noexcept { return *m_strm; }
+  };
+
+ private:
+  /// \brief Checks if a character must be escaped in a quoted string
+  static bool needs_escape(CharT const ch) noexcept {
+    return Traits::lt(ch, CharT(' ')) || Traits::eq(ch, CharT('"')) ||
+           Traits::eq(ch, CharT('\\'));
+  }
+
+  /// \brief Writes a character escaped as in a JSON string
+  void put_escaped(CharT const ch) {
+    if (Traits::eq(ch, CharT('"')) || Traits::eq(ch, CharT('\\'))) {
+      os_type::put(CharT('\\')).put(ch);
+    } else if (Traits::eq(ch, CharT('\n'))) {
+      os_type::put(CharT('\\')).put(CharT('n'));
+    } else if (Traits::eq(ch, CharT('\t'))) {
+      os_type::put(CharT('\\')).put(CharT('t'));
+    } else if (Traits::lt(ch, CharT(' ')) || Traits::eq(ch, CharT(0x7f))) {
+      constexpr char const* const digits = "0123456789abcdef";
+      auto const code = static_cast<unsigned>(Traits::to_int_type(ch));
+      for (auto const c : {'\\', 'u', '0', '0', digits[code >> 4 & 0xf],
+                           digits[code & 0xf]}) {
+        os_type::put(CharT(c));
+      }
+    } else {
+      os_type::put(ch);
+    }
+  }
+
+  /// \brief Returns the calling thread's record stream
+  static basic_recordstream& local() {
+    static thread_local auto strm = basic_recordstream{};
+    return strm;
+  }
+};  // ^ basic_recordstream ^
+
+/// \brief Returns the maximum number of characters a message of type T
+/// takes when written without a stream, or zero if it must be streamed
+/// \note Only types whose text is bounded and matches what a default
+/// formatted stream writes qualify: bool, char, integers, and char arrays
+template <typename T>
+constexpr std::size_t fixed_msg_size() noexcept {
+  using U = std::remove_cv_t<std::remove_reference_t<T>>;
+  if constexpr (std::is_same_v<U, bool> || std::is_same_v<U, char>) {
+    return 1;
+  } else if constexpr (std::is_same_v<U, signed char> ||
+                       std::is_same_v<U, unsigned char> ||
+                       std::is_same_v<U, wchar_t> ||
+                       std::is_same_v<U, char16_t> ||
+                       std::is_same_v<U, char32_t>) {
+    return 0;
+  } else if constexpr (std::is_integral_v<U>) {
+    return std::numeric_limits<U>::digits10 + 2;
+  } else if constexpr (std::is_array_v<U>) {
+    if constexpr (std::is_same_v<std::remove_cv_t<std::remove_extent_t<U>>,
+                                 char>)
+      return std::extent_v<U>;
+    return 0;
+  } else {
+    return 0;
+  }
+}
+
+/// \brief Checks if messages of types Ts can be written without a stream
+template <typename... Ts>
+inline constexpr auto const is_fixed_record =
+    (true && ... && (fixed_msg_size<Ts>() != 0));
+
+/// \brief Maximum number of characters messages of types Ts take
+template <typename... Ts>
+inline constexpr auto const fixed_record_size =
+    (std::size_t{0} + ... + fixed_msg_size<Ts>());
+
+/// \brief Copies narrow characters to a buffer
+/// \returns End of the copied characters
+template <typename CharT>
+CharT* copy_chars(CharT* const out, char const* const str,
+                  std::size_t const len) noexcept {
+  return std::copy(str, str + len, out);
+}
+
+/// \brief Writes a message accepted by fixed_msg_size to a buffer, as a
+/// default formatted stream would
+/// \returns End of the written message
+template <typename CharT, typename T>
+CharT* write_fixed_msg(CharT* out, T const& msg) noexcept {
+  if constexpr (std::is_same_v<T, bool>) {
+    *out++ = CharT(msg ? '1' : '0');
+  } else if constexpr (std::is_same_v<T, char>) {
+    *out++ = CharT(msg);
+  } else if constexpr (std::is_integral_v<T>) {
+    char digits[std::numeric_limits<T>::digits10 + 2];
+    auto const end = std::to_chars(std::begin(digits), std::end(digits), msg);
+    out = copy_chars(out, digits, std::size_t(end.ptr - digits));
+  } else {
+    auto const end = std::find(std::begin(msg), std::end(msg), '\0');
+    out = copy_chars(out, msg, std::size_t(end - std::begin(msg)));
+  }
+  return out;
+}
+
+}  // namespace detail
+
+class call_site;
+
+namespace detail {
+
+/// \brief Returns an identifier no other sink of the process has had
+std::uint64_t next_sink_id() noexcept;
+
+/// \brief Moves records already counted as emitted by their call sites to
+/// the dropped counters, once the batch holding them is dropped
+/// \param sites Call site of each dropped record
+void count_batch_dropped(std::vector<call_site const*> const& sites);
+
+/// \brief Adds a sink to those flush_all flushes
+/// \param sink Sink address
+/// \param flush Function flushing the sink at that address
+void register_sink(void const* sink, void (*flush)(void const*));
+
+/// \brief Removes a sink added with register_sink
+void unregister_sink(void const* sink) noexcept;
+
+/// \brief Records that a logger exists at an address
+void register_logger(void const* logger);
+
+/// \brief Removes a logger added with register_logger
+void unregister_logger(void const* logger) noexcept;
+
+/// \brief Checks if a logger added with register_logger exists at an
+/// address
+bool logger_registered(void const* logger) noexcept;
+
+}  // namespace detail
+
+/// \brief Flushes every sink of the process, writing their pending batches
+/// and buffered output
+void flush_all();
+
+namespace detail {
+
+/// \brief Growable character buffer whose storage is aligned to and sized
+/// in whole cache lines, and is not initialized before it is written
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class line_buffer {
+  /// \brief Frees storage allocated with cache line alignment
+  struct line_delete {
+    void operator()(CharT* const ptr) const noexcept {
+      ::operator delete(ptr, std::align_val_t{cache_line_size});
+    }
+  };
+
+  /// \brief Storage
+  std::unique_ptr<CharT[], line_delete> m_data{};
+
+  /// \brief Characters written
+  std::size_t m_size{0};
+
+  /// \brief Characters allocated
+  std::size_t m_capacity{0};
+
+ public:
+  /// \brief Checks if no characters are written
+  bool empty() const noexcept { return m_size == 0; }
+
+  /// \brief Returns the characters written
+  auto view() const noexcept {
+    return std::basic_string_view<CharT, Traits>{m_data.get(), m_size};
+  }
+
+  /// \brief Returns the characters allocated
+  auto capacity() const noexcept { return m_capacity; }
+
+  /// \brief Appends characters
+  void append(std::basic_string_view<CharT, Traits> const chars) {
+    if (chars.empty()) return;
+    if (m_size + chars.size() > m_capacity) grow(m_size + chars.size());
+    std::copy_n(chars.data(), chars.size(), m_data.get() + m_size);
+    m_size += chars.size();
+  }
+
+  /// \brief Discards the characters written, keeping the storage
+  void clear() noexcept { m_size = 0; }
+
+  /// \brief Discards the characters written and frees the storage
+  void release() noexcept {
+    m_data.reset();
+    m_size = 0;
+    m_capacity = 0;
+  }
+
+ private:
+  /// \brief Reallocates to hold at least size characters, at least doubling
+  void grow(std::size_t const size) {
+    auto bytes = std::max(size, m_capacity * 2) * sizeof(CharT);
+    bytes = (bytes + cache_line_size - 1) / cache_line_size * cache_line_size;
+
+    auto data = std::unique_ptr<CharT[], line_delete>{static_cast<CharT*>(
+        ::operator new(bytes, std::align_val_t{cache_line_size}))};
+    std::copy_n(m_data.get(), m_size, data.get());
+    m_data = std::move(data);
+    m_capacity = bytes / sizeof(CharT);
+  }
+};
+
+}  // namespace detail
+
+/// \brief Output shared by any number of loggers, which serializes their
+/// records into a single stream
+/// \tparam CharT character type
+/// \tparam Traits character type traits
+template <typename CharT, typename Traits = std::char_traits<CharT>>
+class basic_logsink {
+ public:
+  using logstream_type = basic_logstream<CharT, Traits>;
+  using path_type = typename logstream_type::path_type;
+  using view_type = std::basic_string_view<CharT, Traits>;
+
+ private:
+  using rep_type = std::chrono::milliseconds::rep;
+
+  /// \brief Records of one thread waiting to be written together, aligned
+  /// so batches of different threads never share a cache line
+  struct alignas(cache_line_size) record_batch {
+    /// \brief Taken by the owning thread and by threads draining batches
+    std::mutex mtx{};
+
+    /// \brief Records in the order they were logged
+    detail::line_buffer<CharT, Traits> records{};
+
+    /// \brief Number of records by log_level
+    std::array<std::uint32_t, 6> levels{};
+
+    /// \brief Call sites of the records that have one, which counted them
+    /// as emitted when they were added
+    std::vector<call_site const*> sites{};
+
+    /// \brief Time the first record was added
+    rep_type begin{};
+
+    /// \brief Sink the records are written to, nullptr once it is destroyed
+    basic_logsink const* sink{};
+  };
+
+  /// \brief Batches of the calling thread, which are written when the
+  /// thread exits
+  struct thread_batches {
+    /// \brief Batch of each sink the thread has logged to, by sink id
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<record_batch>>>
+        entries{};
+
+    ~thread_batches() {
+      for (auto& entry : entries) {
+        auto l{std::unique_lock{entry.second->mtx}};
+        if (entry.second->sink != nullptr)
+          entry.second->sink->publish_batch(*entry.second);
+      }
+    }
+  };
+
+  /// \brief Identifier of the sink in thread_batches
+  std::uint64_t const m_id{detail::next_sink_id()};
+
+  /// \brief Mutex for m_batches, taken before a batch's mutex
+  std::mutex mutable m_batches_mtx{};
+
+  /// \brief Batches of all threads logging to the sink
+  std::vector<std::shared_ptr<record_batch>> mutable m_batches{};
+
+  /// \brief Batch size in characters that triggers a write, zero to write
+  /// every record on its own
+  std::atomic<std::size_t> m_batch_size_atm{0};
+
+  /// \brief Age in milliseconds that triggers a write of a batch
+  std::atomic<rep_type> m_batch_age_atm{100};
+
+  /// \brief Level of records that are written at once with their batch
+  std::atomic<log_level> m_batch_level_atm{log_level::Warn};
+
+  /// \brief Mutex for basic_logstream object access
+  std::timed_mutex mutable m_lstrm_mtx{};
+
+  /// \brief basic_logstream object
+  logstream_type mutable m_lstrm;
+
+  /// \brief Path of the open file, empty for console output
+  path_type m_path{};
+
+  /// \brief Mutex for fallback basic_logstream object access
+  std::timed_mutex mutable m_fallback_mtx{};
+
+  /// \brief basic_logstream object used while the writer is stalled
+  logstream_type mutable m_fallback_lstrm{};
+
+  /// \brief Start time of the write in progress, zero while idle
+  std::atomic<rep_type> mutable m_write_begin_atm{0};
+
+  /// \brief Time without writer progress before the stall policy applies
+  std::atomic<rep_type> m_stall_timeout_atm{1000};
+
+  /// \brief Action taken once the writer is considered stalled
+  std::atomic<stall_policy> m_stall_policy_atm{stall_policy::Block};
+
+  /// \brief Set while the writer is considered stalled
+  std::atomic<bool> mutable m_stalled_atm{false};
+
+  /// \brief Number of records dropped because of a stalled writer
+  std::atomic<std::uint64_t> mutable m_dropped_atm{0};
+
+  /// \brief Maximum record size in characters, zero for no limit
+  std::atomic<std::size_t> m_record_limit_atm{0};
+
+  /// \brief Handling of records larger than m_record_limit_atm
+  std::atomic<long_record_policy> m_long_record_atm{
+      long_record_policy::Truncate};
+
+  /// \brief Identifier of the last record written in chunks
+  std::atomic<std::uint64_t> mutable m_chunk_id_atm{0};
+
+  /// \brief Encoding of the records loggers write to the sink
+  std::atomic<record_format> m_format_atm{record_format::Text};
+
+  /// \brief Size in bytes at which the output file is rotated, zero to
+  /// never rotate
+  std::uint64_t m_rotate_size{0};
+
+  /// \brief Number of rotated files kept
+  std::size_t m_rotate_keep{5};
+
+  /// \brief Size of the output file in bytes
+  std::uint64_t mutable m_file_size{0};
+
+  /// \brief Records written by log_level
+  std::array<std::atomic<std::uint64_t>, 6> mutable m_records_atm{};
+
+  /// \brief Bytes of the records written
+  std::atomic<std::uint64_t> mutable m_bytes_atm{0};
+
+  /// \brief Writes to the output stream by latency bucket
+  std::array<std::atomic<std::uint64_t>,
+             sink_metrics::latency_bounds.size() + 1> mutable m_latency_atm{};
+
+  /// \brief Total time spent writing to the output stream in nanoseconds
+  std::atomic<std::uint64_t> mutable m_write_time_atm{0};
+
+  /// \brief Last error of the output stream
+  std::error_code mutable m_error{};
+
+  /// \brief Set while records cannot be written to the output stream
+  bool mutable m_write_failed{false};
+
+  /// \brief Text held back while m_write_failed is set, with the number
+  /// of records it holds, more than one for a batch
+  std::deque<std::pair<std::basic_string<CharT, Traits>, std::size_t>>
+      mutable m_spill{};
+
+  /// \brief Characters held in m_spill
+  std::size_t mutable m_spill_size{0};
+
+  /// \brief Records held in m_spill
+  std::size_t mutable m_spill_records{0};
+
+  /// \brief Limit of characters held in m_spill
+  std::size_t m_spill_limit{std::size_t{1} << 20};
+
+  /// \brief Alternate output for records held back, used instead of m_spill
+  /// while open
+  logstream_type mutable m_spill_lstrm{};
+
+  /// \brief Delay before the next attempt to resume output
+  std::chrono::milliseconds mutable m_retry_delay{};
+
+  /// \brief Initial delay between attempts to resume output
+  std::chrono::milliseconds m_retry_min{100};
+
+  /// \brief Maximum delay between attempts to resume output
+  std::chrono::milliseconds m_retry_max{30000};
+
+  /// \brief Time of the next attempt to resume output
+  std::chrono::steady_clock::time_point mutable m_next_retry{};
+
+  /// \brief Number of records lost because of write errors
+  std::atomic<std::uint64_t> mutable m_lost_atm{0};
+
+ public:
+  /// \brief Initializes basic_logsink for console output
+  basic_logsink() : m_lstrm{} { detail::register_sink(this, &flush_sink); }
+
+  /// \brief Initializes basic_logsink for file output
+  /// \param filepath Path to output file
+  IMPLICIT basic_logsink(path_type const& filepath)
+      : m_lstrm{filepath}, m_path{filepath} {
+    seed_file_size();
+    check_open();
+    detail::register_sink(this, &flush_sink);
+  }
+
+  basic_logsink(basic_logsink const&) = delete;
+
+  basic_logsink(basic_logsink&&) = delete;
+
+  basic_logsink& operator=(basic_logsink const&) = delete;
+
+  basic_logsink& operator=(basic_logsink&&) = delete;
+
+  virtual ~basic_logsink() {
+    detail::unregister_sink(this);
+    drain_batches(true);
+  }
+
+  /// \brief Returns the sink writing to a file, creating it unless another
+  /// logger already writes to that file through a sink
+  /// \param filepath Path to output file
+  static std::shared_ptr<basic_logsink> shared(path_type const& filepath) {
+    static auto mtx = std::mutex{};
+    static auto sinks = std::map<path_type, std::weak_ptr<basic_logsink>>{};
+
+    auto ec = std::error_code{};
+    auto key = std::filesystem::weakly_canonical(filepath, ec);
+    if (ec) key = filepath;
+
+    auto l{std::unique_lock{mtx}};
+
+    for (auto it = sinks.begin(); it != sinks.end();)
+      it = it->second.expired() ? sinks.erase(it) : std::next(it);
+
+    if (auto sink = sinks[key].lock()) {
+      if (std::filesystem::weakly_canonical(sink->path(), ec) == key)
+        return sink;
+    }
+
+    auto sink = std::make_shared<basic_logsink>(filepath);
+    sinks[key] = sink;
+    return sink;
+  }
+
+  /// \brief Returns basic_logstream object
+  constexpr auto& stream() const noexcept { return m_lstrm; }
+
+  /// \brief Locks the basic_logstream mutex in the caller's scope
+  /// \returns std::unique_lock<decltype(m_lstrm_mtx)>
+  [[nodiscard]] auto lock_stream() const noexcept {
+    return std::unique_lock{m_lstrm_mtx};
+  }
+
+  /// \brief Returns the path of the open file, empty for console output
+  path_type path() const {
+    auto l{lock_stream()};
+    return m_path;
+  }
+
+  /// \brief Returns the last error of the output stream, cleared when a file
+  /// is opened successfully
+  std::error_code status() const {
+    auto l{lock_stream()};
+    return m_error;
+  }
+
+  /// \brief Sets how long the writer may make no progress before callers
+  /// stop waiting for it and apply the stall policy
+  /// \param timeout New stall timeout
+  /// \returns *this
+  auto& stall_timeout(std::chrono::milliseconds const timeout) noexcept {
+    m_stall_timeout_atm.store(timeout.count());
+    return *this;
+  }
+
+  /// \brief Returns the current stall timeout
+  auto stall_timeout() const noexcept {
+    return std::chrono::milliseconds{m_stall_timeout_atm.load()};
+  }
+
+  /// \brief Sets the action taken by callers once the writer has stalled
+  /// \param policy New stall policy
+  /// \returns *this
+  auto& on_stall(stall_policy const policy) noexcept {
+    m_stall_policy_atm.store(policy);
+    return *this;
+  }
+
+  /// \brief Returns the current stall policy
+  auto on_stall() const noexcept { return m_stall_policy_atm.load(); }
+
+  /// \brief Checks if the writer is currently considered stalled
+  bool stalled() const noexcept { return m_stalled_atm.load(); }
+
+  /// \brief Returns the number of records dropped by a stalled writer
+  auto dropped_count() const noexcept { return m_dropped_atm.load(); }
+
+  /// \brief Sets the maximum size of a record, loggers stop formatting a
+  /// record that reaches it unless the policy is long_record_policy::Chunk
+  /// \param size Limit in characters, zero for no limit
+  /// \returns *this
+  auto& record_limit(std::size_t const size) noexcept {
+    m_record_limit_atm.store(size);
+    return *this;
+  }
+
+  /// \brief Returns the maximum size of a record, zero for no limit
+  auto record_limit() const noexcept { return m_record_limit_atm.load(); }
+
+  /// \brief Sets the handling of records larger than the record limit
+  /// \param policy Truncate to cut records at the limit and append the
+  /// number of characters lost, Chunk to write them as several records
+  /// tagged "[chunk <id> <n>/<count>]", each taking the stream mutex
+  /// separately
+  /// \returns *this
+  auto& on_long_record(long_record_policy const policy) noexcept {
+    m_long_record_atm.store(policy);
+    return *this;
+  }
+
+  /// \brief Returns the handling of records larger than the record limit
+  auto on_long_record() const noexcept { return m_long_record_atm.load(); }
+
+  /// \brief Sets the encoding of the records loggers write to the sink
+  /// \param format Text for the message prefix followed by the messages,
+  /// Logfmt for key=value pairs with the messages under "msg" and each
+  /// slug::field as a key of its own
+  /// \returns *this
+  auto& format(record_format const format) noexcept {
+    m_format_atm.store(format);
+    return *this;
+  }
+
+  /// \brief Returns the encoding of the records loggers write to the sink
+  auto format() const noexcept { return m_format_atm.load(); }
+
+  /// \brief Collects records in a batch per thread that is written with a
+  /// single acquisition of the stream mutex, once it holds size characters,
+  /// when a record arrives after its first record is max_age old, or with a
+  /// record at flush_level or above; flush() and thread exit write pending
+  /// batches
+  /// \note Nothing writes the batch of a thread that stops logging, so its
+  /// records wait for the thread's next record, flush(), or thread exit
+  /// \param size Batch size in characters, zero to write every record on
+  /// its own
+  /// \param max_age Age at which a batch is written when the next record
+  /// arrives
+  /// \param flush_level Lowest level written at once with its batch
+  /// \returns *this
+  auto& batch(std::size_t const size,
+              std::chrono::milliseconds const max_age =
+                  std::chrono::milliseconds{100},
+              log_level const flush_level = log_level::Warn) {
+    m_batch_age_atm.store(max_age.count());
+    m_batch_level_atm.store(flush_level);
+    m_batch_size_atm.store(size);
+    if (size == 0) drain_batches(false);
+    return *this;
+  }
+
+  /// \brief Returns the batch size in characters, zero if records are not
+  /// batched
+  auto batch_size() const noexcept { return m_batch_size_atm.load(); }
+
+  /// \brief Returns the age at which a batch is written
+  auto batch_age() const noexcept {
+    return std::chrono::milliseconds{m_batch_age_atm.load()};
+  }
+
+  /// \brief Returns the lowest level written at once with its batch
+  auto batch_level() const noexcept { return m_batch_level_atm.load(); }
+
+  /// \brief Rotates the output file once it reaches a size: the file is
+  /// renamed to "<file>.1", older files move up to "<file>.<keep>", and a new
+  /// file is opened; files opened with open_shared_file are not rotated
+  /// \param size Size in bytes, uncompressed for files opened with
+  /// open_compressed_file, zero to never rotate
+  /// \param keep Number of rotated files kept, at least one
+  /// \returns *this
+  auto& rotate(std::uint64_t const size, std::size_t const keep = 5) {
+    auto l{lock_stream()};
+    m_rotate_size = size;
+    m_rotate_keep = std::max<std::size_t>(keep, 1);
+    return *this;
+  }
+
+  /// \brief Returns the size at which the output file is rotated
+  auto rotate_size() const {
+    auto l{lock_stream()};
+    return m_rotate_size;
+  }
+
+  /// \brief Checks if records are currently held back because the output
+  /// stream cannot be written
+  bool write_failed() const {
+    auto l{lock_stream()};
+    return m_write_failed;
+  }
+
+  /// \brief Returns the number of records lost because of write errors
+  auto lost_count() const noexcept { return m_lost_atm.load(); }
+
+  /// \brief Sets the limit of records held in memory while the output
+  /// stream cannot be written, the oldest records are lost beyond it
+  /// \param size Limit in characters
+  /// \returns *this
+  auto& spill_limit(std::size_t const size) {
+    auto l{lock_stream()};
+    m_spill_limit = size;
+    trim_spill();
+    return *this;
+  }
+
+  /// \brief Returns the limit of records held in memory in characters
+  auto spill_limit() const {
+    auto l{lock_stream()};
+    return m_spill_limit;
+  }
+
+  /// \brief Sets the delays between attempts to resume output after a
+  /// write error, doubling from min up to max while errors persist
+  /// \param min Delay before the first attempt
+  /// \param max Longest delay between attempts
+  /// \returns *this
+  auto& retry_backoff(std::chrono::milliseconds const min,
+                      std::chrono::milliseconds const max) {
+    auto l{lock_stream()};
+    m_retry_min = min;
+    m_retry_max = std::max(min, max);
+    return *this;
+  }
+
+  /// \brief Opens an alternate file that records are written to while the
+  /// output stream cannot be written, instead of holding them in memory
+  /// \param filepath Path to alternate output file
+  /// \returns *this
+  auto& open_spill_file(path_type const& filepath) {
+    auto l{lock_stream()};
+    m_spill_lstrm.open(filepath);
+    if (auto const& ec = m_spill_lstrm.error(); ec) {
+      detail::report_error(ec, "slug: failed to open spill log file");
+      m_spill_lstrm.close();
+    }
+    return *this;
+  }
+
+  /// \brief Sets the output buffer size of the output and fallback streams
+  /// \param size Buffer size in characters
+  /// \returns *this
+  auto& buffer_size(std::size_t const size) {
+    {
+      auto l{lock_stream()};
+      m_lstrm.buffer_size(size);
+    }
+    auto l{std::unique_lock{m_fallback_mtx}};
+    m_fallback_lstrm.buffer_size(size);
+    return *this;
+  }
+
+  /// \brief Returns the output buffer size in characters
+  auto buffer_size() const {
+    auto l{lock_stream()};
+    return m_lstrm.buffer_size();
+  }
+
+  /// \brief Returns the memory held by the sink's buffers
+  auto memory_used() const {
+    auto usage = memory_usage{};
+    {
+      auto l{lock_stream()};
+      usage.stream_buffers = m_lstrm.memory_used();
+      usage.spill_buffers = m_spill_size * sizeof(CharT);
+    }
+    {
+      auto l{std::unique_lock{m_batches_mtx}};
+      for (auto const& b : m_batches) {
+        auto bl{std::unique_lock{b->mtx}};
+        usage.batch_buffers += b->records.capacity() * sizeof(CharT);
+      }
+    }
+    auto l{std::unique_lock{m_fallback_mtx}};
+    usage.fallback_buffers = m_fallback_lstrm.memory_used();
+    return usage;
+  }
+
+  /// \brief Returns a snapshot of the sink's counters
+  sink_metrics metrics() const {
+    auto snapshot = sink_metrics{};
+    for (auto i = std::size_t{0}; i < m_records_atm.size(); ++i)
+      snapshot.records[i] = m_records_atm[i].load(std::memory_order_relaxed);
+    for (auto i = std::size_t{0}; i < m_latency_atm.size(); ++i) {
+      snapshot.write_latency[i] =
+          m_latency_atm[i].load(std::memory_order_relaxed);
+    }
+    snapshot.bytes = m_bytes_atm.load(std::memory_order_relaxed);
+    snapshot.write_time = m_write_time_atm.load(std::memory_order_relaxed);
+    snapshot.dropped = dropped_count();
+    snapshot.lost = lost_count();
+
+    auto l{lock_stream()};
+    snapshot.spilled = m_spill_records;
+    return snapshot;
+  }
+
+  /// \brief Opens a file for output, after writing pending batches to the
+  /// previous output
+  /// \param filepath Path to output file
+  /// \returns *this
+  auto& open_file(path_type const& filepath) {
+    drain_batches(false);
+    auto l{lock_stream()};
+    m_lstrm.open(filepath);
+    m_path = filepath;
+    seed_file_size();
+    check_open();
+    resume();
+    return *this;
+  }
+
+  /// \brief Opens a file shared with other processes for output
+  /// \param filepath Path to output file
+  /// \param max_write Largest single write in bytes
+  /// \param oversize Handling of records larger than max_write
+  /// \returns *this
+  auto& open_shared_file(
+      path_type const& filepath,
+      std::size_t const max_write = default_atomic_write,
+      oversize_policy const oversize = oversize_policy::Split) {
+    drain_batches(false);
+    auto l{lock_stream()};
+    m_lstrm.open_shared(filepath, max_write, oversize);
+    m_path = filepath;
+    check_open();
+    resume();
+    return *this;
+  }
+
+  /// \brief Opens a file for compressed output, which is compressed in
+  /// blocks by the writing thread while it holds the stream mutex
+  /// \note A partly filled block is written by the first record after it
+  /// is compress_interval old, or by flush(); nothing writes it while the
+  /// sink is idle
+  /// \param filepath Path to output file
+  /// \param block_size Size of independently compressed blocks in
+  /// characters, at most this much output is lost if the process crashes
+  /// \param level Compression level from 1 to 9
+  /// \param codec Compression codec
+  /// \returns *this
+  auto& open_compressed_file(
+      path_type const& filepath,
+      std::size_t const block_size = default_compress_block,
+      int const level = default_compress_level,
+      compression_codec const codec = compression_codec::Auto) {
+    drain_batches(false);
+    auto l{lock_stream()};
+    m_lstrm.open_compressed(filepath, block_size, level, codec);
+    m_path = filepath;
+    seed_file_size();
+    check_open();
+    resume();
+    return *this;
+  }
+
+  /// \brief Opens a file in the mode of the open file, keeping the
+  /// settings of a shared or compressed file; opens a plain file after
+  /// console output
+  /// \param filepath Path to output file
+  /// \returns *this
+  auto& switch_file(path_type const& filepath) {
+    auto l{lock_stream()};
+    auto const shared = m_lstrm.is_shared();
+    auto const compressed = m_lstrm.is_compressed();
+    auto const max_write = m_lstrm.max_write();
+    auto const oversize = m_lstrm.oversize();
+    auto const block_size = m_lstrm.compressed_block_size();
+    auto const level = m_lstrm.compression_level();
+    auto const codec = m_lstrm.codec();
+    l.unlock();
+
+    if (shared) return open_shared_file(filepath, max_write, oversize);
+    if (compressed)
+      return open_compressed_file(filepath, block_size, level, codec);
+    return open_file(filepath);
+  }
+
+  /// \brief Writes pending batches, closes the currount output file and
+  /// switches to console output
+  /// \returns *this
+  auto& close_file() {
+    drain_batches(false);
+    auto l{lock_stream()};
+    m_lstrm.close();
+    m_path.clear();
+    resume();
+    return *this;
+  }
+
+  /// \brief Opens a file for output while the writer is stalled, which is
+  /// used with stall_policy::Fallback instead of console output
+  /// \param filepath Path to fallback output file
+  /// \returns *this
+  auto& open_fallback_file(path_type const& filepath) {
+    auto l{std::unique_lock{m_fallback_mtx}};
+    m_fallback_lstrm.open(filepath);
+    if (auto const& ec = m_fallback_lstrm.error(); ec)
+      detail::report_error(ec, "slug: failed to open fallback log file");
+    return *this;
+  }
+
+  /// \brief Writes the batches of all threads and flushes the output and
+  /// fallback streams, giving up on a stream whose writer stays stalled past
+  /// the stall timeout
+  /// \returns *this
+  auto const& flush() const {
+    drain_batches(false);
+
+    auto const block = m_stall_policy_atm.load() == stall_policy::Block;
+    if (auto l = block ? lock_stream() : lock_unless_stalled(stall_timeout());
+        l.owns_lock()) {
+      m_lstrm.flush_block();
+    }
+    if (block) {
+      auto l{std::unique_lock{m_fallback_mtx}};
+      m_fallback_lstrm.flush_block();
+    } else if (auto l = std::unique_lock{m_fallback_mtx, stall_timeout()};
+               l.owns_lock()) {
+      m_fallback_lstrm.flush_block();
+    }
+    return *this;
+  }
+
+  /// \brief Writes a single formatted record, applying the stall policy if
+  /// the writer makes no progress within the stall timeout, and splitting
+  /// it into chunks if it exceeds the record limit under
+  /// long_record_policy::Chunk
+  /// \param record Record including its trailing newline
+  /// \param lvl Logging level the record is counted under
+  /// \param site Call site counting the record, if a batch holding it is
+  /// dropped later
+  /// \returns true if the record was written to the output or fallback
+  /// stream or added to a batch, false if it was dropped
+  bool write(view_type const record, log_level const lvl = log_level::None,
+             call_site const* const site = nullptr) const {
+    // Chunks of OTLP records would not be valid JSON
+    auto const limit = format() != record_format::Otlp ? record_limit() : 0;
+    auto const chunked = limit != 0 && record.size() > limit &&
+                         on_long_record() == long_record_policy::Chunk;
+
+    auto written = false;
+    if (auto const size = m_batch_size_atm.load(std::memory_order_relaxed);
+        size != 0) {
+      if (!chunked) return write_batched(record, lvl, size, site);
+      auto& b = local_batch();
+      auto l{std::unique_lock{b.mtx}};
+      publish_batch(b);
+      written = write_chunks(record, limit);
+    } else {
+      written = chunked ? write_chunks(record, limit) : write_single(record);
+    }
+
+    if (written) {
+      m_records_atm[level_index(lvl)].fetch_add(1, std::memory_order_relaxed);
+      m_bytes_atm.fetch_add(record.size() * sizeof(CharT),
+                            std::memory_order_relaxed);
+    }
+    return written;
+  }
+
+ private:
+  /// \brief Flushes the sink at an address registered with register_sink
+  static void flush_sink(void const* const sink) {
+    static_cast<basic_logsink const*>(sink)->flush();
+  }
+
+  /// \brief Returns the index of a level in the record counters
+  static std::size_t level_index(log_level const lvl) noexcept {
+    return std::min<std::size_t>(static_cast<std::size_t>(lvl), 5);
+  }
+
+  /// \brief Returns the calling thread's batch for the sink, registering a
+  /// new one on first use
+  record_batch& local_batch() const {
+    thread_local auto local = thread_batches{};
+    for (auto const& entry : local.entries) {
+      if (entry.first == m_id) return *entry.second;
+    }
+
+    // Batches of destroyed sinks are no longer needed
+    local.entries.erase(
+        std::remove_if(local.entries.begin(), local.entries.end(),
+                       [](auto const& entry) {
+                         auto l{std::unique_lock{entry.second->mtx}};
+                         return entry.second->sink == nullptr;
+                       }),
+        local.entries.end());
+
+    auto b = std::make_shared<record_batch>();
+    b->sink = this;
+    {
+      auto l{std::unique_lock{m_batches_mtx}};
+      // Batches only the sink still owns belong to exited threads, which
+      // wrote them on exit
+      m_batches.erase(std::remove_if(m_batches.begin(), m_batches.end(),
+                                     [](auto const& other) {
+                                       return other.use_count() == 1;
+                                     }),
+                      m_batches.end());
+      m_batches.push_back(b);
+    }
+    local.entries.emplace_back(m_id, b);
+    return *local.entries.back().second;
+  }
+
+  /// \brief Adds a record to the calling thread's batch and writes the
+  /// batch if it is full, old, or the record's level asks for it
+  /// \returns false if the batch was written and dropped
+  bool write_batched(view_type const record, log_level const lvl,
+                     std::size_t const size,
+                     call_site const* const site) const {
+    auto& b = local_batch();
+    auto l{std::unique_lock{b.mtx}};
+
+    auto const now = current_time();
+    if (b.records.empty()) b.begin = now;
+    b.records.append(record);
+    ++b.levels[level_index(lvl)];
+
+    if (b.records.view().size() >= size || lvl >= m_batch_level_atm.load() ||
+        now - b.begin >= m_batch_age_atm.load())
+      return publish_batch(b);
+
+    // The caller counts a record written at once from the return value
+    if (site != nullptr) b.sites.push_back(site);
+    return true;
+  }
+
+  /// \brief Writes a batch as a single record, with the batch's mutex held
+  /// \returns false if the batch was dropped
+  bool publish_batch(record_batch& b) const {
+    if (b.records.empty()) return true;
+
+    auto const count = std::accumulate(b.levels.begin(), b.levels.end(),
+                                       std::size_t{0});
+    auto const written = write_single(b.records.view(), count);
+    if (written) {
+      for (auto i = std::size_t{0}; i < b.levels.size(); ++i) {
+        m_records_atm[i].fetch_add(b.levels[i], std::memory_order_relaxed);
+      }
+      m_bytes_atm.fetch_add(b.records.view().size() * sizeof(CharT),
+                            std::memory_order_relaxed);
+    } else if (!b.sites.empty()) {
+      detail::count_batch_dropped(b.sites);
+    }
+    b.sites.clear();
+
+    // A burst may have grown the batch far beyond its usual size
+    auto const keep = m_batch_size_atm.load(std::memory_order_relaxed) * 2;
+    if (b.records.capacity() > std::max<std::size_t>(keep, 256)) {
+      b.records.release();
+      std::vector<call_site const*>{}.swap(b.sites);
+    } else {
+      b.records.clear();
+    }
+    b.levels = {};
+    return written;
+  }
+
+  /// \brief Writes the pending batches of all threads
+  /// \param detach Marks the batches as belonging to no sink, as the sink
+  /// is being destroyed
+  void drain_batches(bool const detach) const {
+    auto l{std::unique_lock{m_batches_mtx}};
+    for (auto const& b : m_batches) {
+      auto bl{std::unique_lock{b->mtx}};
+      publish_batch(*b);
+      if (detach) b->sink = nullptr;
+    }
+    if (detach) m_batches.clear();
+  }
+
+  /// \brief Writes a single record, applying the stall policy
+  /// \param record Record, or the records of a batch
+  /// \param count Number of records in record
+  /// \returns true if the record was written
+  bool write_single(view_type const record,
+                    std::size_t const count = 1) const {
+    auto const policy = m_stall_policy_atm.load();
+
+    if (policy == stall_policy::Block) {
+      auto l{lock_stream()};
+      write_locked(record, count);
+      return true;
+    }
+
+    auto const timeout = stall_timeout();
+
+    if (auto l = lock_unless_stalled(timeout); l.owns_lock()) {
+      write_locked(record, count);
+      return true;
+    }
+
+    if (!m_stalled_atm.exchange(true)) {
+      char what[96];
+      std::snprintf(what, sizeof(what),
+                    "slug: log writer made no progress for %lld ms, %s",
+                    static_cast<long long>(timeout.count()),
+                    policy == stall_policy::Drop ? "dropping records"
+                                                 : "using fallback output");
+      detail::report_error(std::make_error_code(std::errc::timed_out), what);
+    }
+
+    if (policy == stall_policy::Fallback) {
+      if (auto l = std::unique_lock{m_fallback_mtx, timeout}; l.owns_lock()) {
+        m_fallback_lstrm.write(record.data(),
+                               static_cast<std::streamsize>(record.size()));
+        m_fallback_lstrm.flush();
+        return true;
+      }
+    }
+
+    m_dropped_atm.fetch_add(count, std::memory_order_relaxed);
+    return false;
+  }
+
+  /// \brief Writes a record larger than the record limit as a series of
+  /// tagged records, so other writers can proceed between them
+  /// \returns true if every chunk was written
+  bool write_chunks(view_type record, std::size_t const limit) const {
+    if (!record.empty() && Traits::eq(record.back(), CharT('\n')))
+      record.remove_suffix(1);
+
+    auto const id = m_chunk_id_atm.fetch_add(1) + 1;
+    auto const count = (record.size() + limit - 1) / limit;
+    auto chunk = std::basic_string<CharT, Traits>{};
+    auto written = true;
+
+    for (auto n = std::size_t{1}; !record.empty(); ++n) {
+      auto const tag = "[chunk " + std::to_string(id) + ' ' +
+                       std::to_string(n) + '/' + std::to_string(count) + "] ";
+      auto const part = record.substr(0, limit);
+      record.remove_prefix(part.size());
+
+      chunk.assign(tag.begin(), tag.end());
+      chunk.append(part).push_back(CharT('\n'));
+      written = write_single(chunk) && written;
+    }
+    return written;
+  }
+
+  /// \brief Writes a single record with the stream mutex held, tracking
+  /// writer progress for stall detection
+  /// \param record Record, or the records of a batch
+  /// \param count Number of records in record
+  void write_locked(view_type const record, std::size_t const count) const {
+    namespace chr = std::chrono;
+    auto const begin = chr::steady_clock::now();
+    m_write_begin_atm.store(
+        chr::duration_cast<chr::milliseconds>(begin.time_since_epoch())
+            .count(),
+        std::memory_order_relaxed);
+
+    if (m_write_failed) {
+      if (std::chrono::steady_clock::now() < m_next_retry || !resume()) {
+        spill(record, count);
+      } else if (!write_stream(record)) {
+        write_failure(record, count);
+      }
+    } else if (!write_stream(record)) {
+      m_error = detail::last_error();
+      detail::report_error(m_error, "slug: failed to write log record");
+      write_failure(record, count);
+    }
+
+    m_write_begin_atm.store(0, std::memory_order_relaxed);
+    count_write(chr::steady_clock::now() - begin);
+
+    if (m_stalled_atm.load(std::memory_order_relaxed) &&
+        m_stalled_atm.exchange(false)) {
+      char what[80];
+      std::snprintf(what, sizeof(what),
+                    "slug: log writer recovered, %llu records dropped",
+                    static_cast<unsigned long long>(m_dropped_atm.load()));
+      detail::report_error(std::error_code{}, what);
+    }
+  }
+
+  /// \brief Counts a write to the output stream in the latency histogram
+  void count_write(std::chrono::steady_clock::duration const elapsed) const {
+    namespace chr = std::chrono;
+    auto const ns = static_cast<std::uint64_t>(
+        chr::duration_cast<chr::nanoseconds>(elapsed).count());
+    auto const& bounds = sink_metrics::latency_bounds;
+    auto const bucket =
+        std::lower_bound(bounds.begin(), bounds.end(), ns) - bounds.begin();
+    m_latency_atm[static_cast<std::size_t>(bucket)].fetch_add(
+        1, std::memory_order_relaxed);
+    m_write_time_atm.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  /// \brief Writes a record to the output stream, with the stream mutex held
+  /// \returns true on success
+  bool write_stream(view_type const record) const {
+    errno = 0;
+    m_lstrm.write(record.data(), static_cast<std::streamsize>(record.size()));
+    m_lstrm.flush();
+    if (m_lstrm.fail()) return false;
+
+    m_file_size += record.size() * sizeof(CharT);
+    if (m_rotate_size != 0 && m_file_size >= m_rotate_size &&
+        m_lstrm.is_open() && !m_lstrm.is_shared()) {
+      rotate_file();
+    }
+    return true;
+  }
+
+  /// \brief Renames the output file and its rotated predecessors and opens
+  /// a new file, with the stream mutex held
+  void rotate_file() const {
+    auto const numbered = [&](std::size_t const n) {
+      auto path = m_path;
+      path += "." + std::to_string(n);
+      return path;
+    };
+
+    auto const compressed = m_lstrm.is_compressed();
+    auto const block_size = m_lstrm.compressed_block_size();
+    auto const level = m_lstrm.compression_level();
+    auto const codec = m_lstrm.codec();
+
+    auto ec = std::error_code{};
+    m_lstrm.close();
+    for (auto n = m_rotate_keep; n > 1; --n)
+      std::filesystem::rename(numbered(n - 1), numbered(n), ec);
+    std::filesystem::rename(m_path, numbered(1), ec);
+    if (ec) detail::report_error(ec, "slug: failed to rotate log file");
+
+    if (compressed) {
+      m_lstrm.open_compressed(m_path, block_size, level, codec);
+    } else {
+      m_lstrm.open(m_path);
+    }
+    m_file_size = 0;
+    check_open();
+  }
+
+  /// \brief Holds back a record that could not be written and schedules the
+  /// next attempt to resume output, with the stream mutex held
+  void write_failure(view_type const record, std::size_t const count) const {
+    m_retry_delay = m_write_failed ? std::min(m_retry_delay * 2, m_retry_max)
+                                   : m_retry_min;
+    m_next_retry = std::chrono::steady_clock::now() + m_retry_delay;
+    m_write_failed = true;
+    spill(record, count);
+  }
+
+  /// \brief Holds back a record while output is failing, with the stream
+  /// mutex held
+  void spill(view_type const record, std::size_t const count) const {
+    if (m_spill_lstrm.is_open()) {
+      m_spill_lstrm.write(record.data(),
+                          static_cast<std::streamsize>(record.size()));
+      m_spill_lstrm.flush();
+      if (m_spill_lstrm.good()) return;
+      m_spill_lstrm.close();
+    }
+
+    m_spill.emplace_back(record, count);
+    m_spill_size += record.size();
+    m_spill_records += count;
+    trim_spill();
+  }
+
+  /// \brief Drops the oldest held back records beyond the spill limit, with
+  /// the stream mutex held
+  void trim_spill() const {
+    while (m_spill_size > m_spill_limit && !m_spill.empty()) {
+      auto const& [text, count] = m_spill.front();
+      m_spill_size -= text.size();
+      m_spill_records -= count;
+      m_lost_atm.fetch_add(count, std::memory_order_relaxed);
+      m_spill.pop_front();
+    }
+  }
+
+  /// \brief Reopens the output stream if needed and writes the held back
+  /// records, with the stream mutex held
+  /// \returns true if output has resumed
+  bool resume() const {
+    if (!m_write_failed) return true;
+
+    if (!m_lstrm.good()) m_lstrm.reopen();
+
+    while (!m_spill.empty()) {
+      auto const& [text, count] = m_spill.front();
+      if (!write_stream(text)) {
+        m_retry_delay = std::min(m_retry_delay * 2, m_retry_max);
+        m_next_retry = std::chrono::steady_clock::now() + m_retry_delay;
+        return false;
+      }
+      m_spill_size -= text.size();
+      m_spill_records -= count;
+      m_spill.pop_front();
+    }
+
+    m_write_failed = false;
+    m_error.clear();
+    char what[80];
+    std::snprintf(what, sizeof(what),
+                  "slug: log output resumed, %llu records lost",
+                  static_cast<unsigned long long>(m_lost_atm.load()));
+    detail::report_error(std::error_code{}, what);
+    return true;
+  }
+
+  /// \brief Counts the size of the file just opened from its current size,
+  /// with the stream mutex held
+  /// \note The compressed size of an existing compressed file stands in for
+  /// its uncompressed size, which only the file's blocks record
+  void seed_file_size() const {
+    auto ec = std::error_code{};
+    m_file_size = std::filesystem::file_size(m_path, ec);
+    if (ec) m_file_size = 0;
+  }
+
+  /// \brief Records and reports the outcome of opening a file, with the
+  /// stream mutex held
+  void check_open() const {
+    m_error = m_lstrm.error();
+    if (m_error) detail::report_error(m_error, "slug: failed to open log file");
+  }
+
+  /// \brief Locks the stream mutex unless the thread holding it is stuck in
+  /// a write for longer than the stall timeout
+  /// \note A holder that is not writing, such as lock_stream or a rotation,
+  /// is waited for however long it takes
+  /// \returns Lock that owns the mutex unless the writer stalled
+  std::unique_lock<std::timed_mutex> lock_unless_stalled(
+      std::chrono::milliseconds const timeout) const {
+    namespace chr = std::chrono;
+    // Skip the wait entirely once the writer is known to be stuck; the
+    // system_clock deadline waits with pthread_mutex_timedlock, which thread
+    // sanitizers track, and a clock change only costs another pass
+    while (!writer_stalled(timeout)) {
+      auto const deadline = chr::system_clock::now() + timeout;
+      if (auto l = std::unique_lock{m_lstrm_mtx, deadline}; l.owns_lock())
+        return l;
+    }
+    return {};
+  }
+
+  /// \brief Checks if the write in progress has exceeded the stall timeout
+  bool writer_stalled(std::chrono::milliseconds const timeout) const noexcept {
+    auto const begin = m_write_begin_atm.load(std::memory_order_relaxed);
+    return begin != 0 && current_time() - begin >= timeout.count();
+  }
+
+  /// \brief Returns the current time since epoch in milliseconds
+  static rep_type current_time() noexcept {
+    namespace chr = std::chrono;
+    auto const now = chr::steady_clock::now().time_since_epoch();
+    return chr::duration_cast<chr::milliseconds>(now).count();
+  }
+};  // ^ basic_logsink ^
+
+using logsink = basic_logsink<char>;
+using wlogsink = basic_logsink<wchar_t>;
+using u16logsink = basic_logsink<char16_t>;
+using u32logsink = basic_logsink<char32_t>;
+
+/// \brief Location of a log statement, defined as a static object by the
+/// SLUG_INFO family of macros and registered on first use
+class call_site {
+  /// \brief Source file of the statement
+  char const* m_file;
+
+  /// \brief Source line of the statement
+  unsigned m_line;
+
+  /// \brief Logging level of the statement
+  log_level m_level;
+
+  /// \brief Index of the call site in the registry
+  std::size_t m_index;
+
+ public:
+  call_site(char const* file, unsigned line, log_level lvl);
+
+  call_site(call_site const&) = delete;
+
+  call_site& operator=(call_site const&) = delete;
+
+  /// \brief Returns the source file of the statement
+  constexpr auto file() const noexcept { return m_file; }
+
+  /// \brief Returns the source line of the statement
+  constexpr auto line() const noexcept { return m_line; }
+
+  /// \brief Returns the logging level of the statement
+  constexpr auto level() const noexcept { return m_level; }
+
+  /// \brief Returns the index of the call site in the registry
+  constexpr auto index() const noexcept { return m_index; }
+};  // ^ call_site ^
+
+/// \brief Counters of a call site summed over all threads
+struct call_site_stats {
+  /// \brief Call site the counters belong to
+  call_site const* site{nullptr};
+
+  /// \brief Records written to the sink
+  std::uint64_t emitted{0};
+
+  /// \brief Records rejected by the logger's level
+  std::uint64_t suppressed{0};
+
+  /// \brief Records the sink dropped
+  std::uint64_t dropped{0};
+
+  /// \brief Bytes of the records passed to the sink
+  std::uint64_t bytes{0};
+};
+
+/// \brief Sums the per-thread counters of every registered call site
+/// \returns Counters in registration order
+std::vector<call_site_stats> collect_call_site_stats();
+
+/// \brief Returns the call sites that produced the most bytes
+/// \param count Maximum number of call sites returned
+std::vector<call_site_stats> top_call_sites(std::size_t count);
+
+/// \brief Writes a table of the call sites that produced the most bytes
+/// \param os Output stream
+/// \param count Maximum number of call sites written
+void dump_call_sites(std::ostream& os, std::size_t count = 20);
+
+namespace detail {
+
+/// \brief Counts a record passed to the sink in the calling thread's
+/// counters of a call site
+/// \param bytes Size of the record in bytes
+/// \param written false if the sink dropped the record
+void count_call_site(call_site const& site, std::size_t bytes,
+                     bool written);
+
+/// \brief Counts a record rejected by the logger's level in the calling
+/// thread's counters of a call site
+void count_suppressed(call_site const& site);
+
+}  // namespace detail
+
+/// \brief Header of a call site's static descriptor, which the SLUG_INFO
+/// family of macros places in the "slug_catalog" section of ELF binaries;
+/// the source file and the argument type codes follow it as null terminated
+/// strings
+struct alignas(8) catalog_entry {
+  /// \brief Value of magic in every entry
+  static constexpr std::uint32_t entry_magic = 0x43474c53;  // "SLGC"
+
+  /// \brief Marks the start of an entry
+  std::uint32_t magic{entry_magic};
+
+  /// \brief Size of the entry including the strings and padding
+  std::uint32_t size{};
+
+  /// \brief Source line of the statement
+  std::uint32_t line{};
+
+  /// \brief Logging level of the statement
+  log_level level{};
+
+  /// \brief Returns the source file of the statement
+  char const* file() const noexcept {
+    return reinterpret_cast<char const*>(this) + sizeof(catalog_entry);
+  }
+
+  /// \brief Returns one character per message argument: b bool, c char,
+  /// i signed and u unsigned integer, f floating point, s string, e enum,
+  /// p pointer, k slug::field, o any other type
+  char const* types() const noexcept {
+    auto const* const path = file();
+    return path + std::char_traits<char>::length(path) + 1;
+  }
+};
+
+static_assert(sizeof(catalog_entry) == 16,
+              "SLUG_CATALOG_ENTRY assembles entries with a 16 byte header");
+
+/// \brief Call site descriptor read from a catalog
+struct catalog_site {
+  /// \brief Source file of the statement
+  std::string file{};
+
+  /// \brief Source line of the statement
+  unsigned line{};
+
+  /// \brief Logging level of the statement
+  log_level level{};
+
+  /// \brief Argument type codes, see catalog_entry::types
+  std::string types{};
+};
+
+/// \brief Returns the call site descriptors linked into the running
+/// program, empty unless the platform supports the catalog section
+std::vector<catalog_site> program_catalog();
 
- private:
-  /// \brief File buffer
-  filebuf_type m_filebuf{};
+/// \brief Reads the call site descriptors from the catalog section of an
+/// ELF binary without loading it
+/// \param filepath Path to executable or shared library
+/// \param sites Receives the descriptors
+/// \returns false if the file cannot be read or is not an ELF file; a
+/// binary without a catalog section yields no descriptors
+bool read_catalog(std::filesystem::path const& filepath,
+                  std::vector<catalog_site>& sites);
 
- public:
-  /// \brief Initialize basic_logstream for console output
-  basic_logstream() : os_type{std::clog.rdbuf()} {}
+namespace detail {
 
-  /// \brief Initialize basic_logstream for file output
-  /// \param filepath Path to output file
-  IMPLICIT basic_logstream(path_type const& filepath)
-      : os_type{std::clog.rdbuf()} {
-    open(filepath);
+/// \brief Returns the catalog type code of a message argument type
+template <typename T>
+constexpr char catalog_type_code() {
+  using type = std::remove_cv_t<std::remove_reference_t<T>>;
+  if constexpr (is_field<type>::value) {
+    return 'k';
+  } else if constexpr (std::is_same_v<type, bool>) {
+    return 'b';
+  } else if constexpr (std::is_same_v<type, char>) {
+    return 'c';
+  } else if constexpr (std::is_integral_v<type>) {
+    return std::is_signed_v<type> ? 'i' : 'u';
+  } else if constexpr (std::is_floating_point_v<type>) {
+    return 'f';
+  } else if constexpr (std::is_enum_v<type>) {
+    return 'e';
+  } else if constexpr (std::is_convertible_v<type const&, std::string_view>) {
+    return 's';
+  } else if constexpr (std::is_pointer_v<type>) {
+    return 'p';
+  } else {
+    return 'o';
   }
+}
 
-  basic_logstream(basic_logstream const&) = delete;
+/// \brief Argument type codes of a log statement
+template <typename... Ts>
+struct catalog_types {
+  static constexpr char value[] = {catalog_type_code<Ts>()..., '\0'};
+};
 
-  basic_logstream(basic_logstream&&) = default;
+/// \brief Deduces the catalog_types of a statement's arguments, only used
+/// in unevaluated contexts
+template <typename... Ts>
+catalog_types<Ts...> catalog_args(Ts const&...);
 
-  basic_logstream& operator=(basic_logstream const&) = delete;
+/// \brief Number of argument type codes recorded in a catalog entry
+static constexpr auto const max_catalog_types = std::size_t{16};
 
-  basic_logstream& operator=(basic_logstream&&) = default;
+/// \brief I-th argument type code of a catalog_types, or zero past the last
+/// argument
+template <typename Types, std::size_t I>
+static constexpr char catalog_code =
+    I < sizeof(Types::value) ? Types::value[I] : '\0';
 
-  virtual ~basic_logstream() { close(); }
+}  // namespace detail
 
-  /// \brief Checks if the file buffer's associated file is open
-  bool is_open() const { return m_filebuf.is_open(); }
+/// \brief Trivially copyable handle to a logger, which checks a message's
+/// level with a relaxed load of the logger's level before forwarding it
+/// \note A handle does not own its logger, which must outlive every copy of
+/// the handle; debug builds assert that the logger still exists whenever a
+/// handle is used
+/// \tparam Logger basic_logger type
+template <typename Logger>
+class basic_log_handle {
+  /// \brief Logger messages are forwarded to
+  Logger const* m_logger{};
 
-  /// \brief Opens file for output
-  /// \param filepath Path to output file
-  /// \returns *this
-  IMPLICIT basic_logstream& open(path_type const& filepath) {
-    constexpr auto flags = std::ios::binary | std::ios::out | std::ios::app;
+ public:
+  /// \brief Initializes a handle that discards all messages
+  constexpr basic_log_handle() noexcept = default;
 
-    if (is_open()) close();
+  /// \brief Initializes a handle to a logger
+  /// \param logger Logger messages are forwarded to, which must outlive
+  /// the handle
+  explicit basic_log_handle(Logger const& logger) noexcept
+      : m_logger{std::addressof(logger)} {}
 
-    if (auto&& buf = m_filebuf.open(filepath, flags); buf == nullptr)
-      os_type::setstate(std::ios::failbit);
+  /// \brief Returns the logger messages are forwarded to
+  constexpr auto logger() const noexcept { return m_logger; }
 
-    os_type::flush();
-    os_type::rdbuf(&m_filebuf);
+  /// \brief Returns the logger's current logging level, slug::none for a
+  /// handle without a logger
+  auto min_log_level() const noexcept {
+    if (m_logger == nullptr) return log_level::None;
+    assert(detail::logger_registered(m_logger));
+    return m_logger->min_log_level();
+  }
 
+  /// \brief Logs fatal message(s) through the logger
+  /// \tparam Ts Template parameter pack of message types
+  /// \param msgs Function parameter pack of messages to log
+  /// \returns *this
+  template <typename... Ts>
+  auto const& fatal(Ts&&... msgs) const {
+    if (slug::fatal >= min_log_level())
+      m_logger->fatal(std::forward<Ts>(msgs)...);
     return *this;
   }
 
-  /// \brief Closes the file buffer if open and switches to console output
+  /// \brief Logs error message(s) through the logger
+  /// \tparam Ts Template parameter pack of message types
+  /// \param msgs Function parameter pack of messages to log
   /// \returns *this
-  basic_logstream& close() {
-    os_type::flush();
-
-    if (is_open()) {
-      m_filebuf.close();
-      os_type::rdbuf(std::clog.rdbuf());
-    }
-
+  template <typename... Ts>
+  auto const& error(Ts&&... msgs) const {
+    if (slug::error >= min_log_level())
+      m_logger->error(std::forward<Ts>(msgs)...);
     return *this;
   }
 
-  /// \brief Swap implementation
-  void swap(basic_logstream& rhs) {
-    if (this != std::addressof(rhs)) {
-      os_type::swap(rhs);
-      m_filebuf.swap(rhs.m_filebuf);
-    }
+  /// \brief Logs warning message(s) through the logger
+  /// \tparam Ts Template parameter pack of message types
+  /// \param msgs Function parameter pack of messages to log
+  /// \returns *this
+  template <typename... Ts>
+  auto const& warning(Ts&&... msgs) const {
+    if (slug::warn >= min_log_level())
+      m_logger->warning(std::forward<Ts>(msgs)...);
+    return *this;
   }
-};  // ^ basic_logstream ^
 
-/// \brief basic_logstream swap specialization
-template <typename CharT, typename Traits = std::char_traits<CharT>>
-void swap(basic_logstream<CharT, Traits>& lhs,
-          basic_logstream<CharT, Traits>& rhs) {
-  lhs.swap(rhs);
-}
+  /// \brief Logs info message(s) through the logger
+  /// \tparam Ts Template parameter pack of message types
+  /// \param msgs Function parameter pack of messages to log
+  /// \returns *this
+  template <typename... Ts>
+  auto const& info(Ts&&... msgs) const {
+    if (slug::info >= min_log_level())
+      m_logger->info(std::forward<Ts>(msgs)...);
+    return *this;
+  }
 
-using logstream = basic_logstream<char>;
-using wlogstream = basic_logstream<wchar_t>;
-using u16logstream = basic_logstream<char16_t>;
-using u32logstream = basic_logstream<char32_t>;
+  /// \brief Logs trace message(s) through the logger
+  /// \tparam Ts Template parameter pack of message types
+  /// \param msgs Function parameter pack of messages to log
+  /// \returns *this
+  template <typename... Ts>
+  auto const& trace(Ts&&... msgs) const {
+    if (slug::trace >= min_log_level())
+      m_logger->trace(std::forward<Ts>(msgs)...);
+    return *this;
+  }
+};  // ^ basic_log_handle ^
 
 /// \brief Main logger class
 /// \tparam CharT
@@ -135,60 +3451,95 @@ template <typename CharT, typename Traits = std::char_traits<CharT>,
 class basic_logger {
  public:
   using string_allocator_type = StrAllocator;
-  using logstream_type = basic_logstream<CharT, Traits>;
+  using logsink_type = basic_logsink<CharT, Traits>;
+  using logstream_type = typename logsink_type::logstream_type;
   using path_type = typename logstream_type::path_type;
   using string_type = std::basic_string<CharT, Traits, StrAllocator>;
   using stringstream_type = std::basic_stringstream<CharT, Traits>;
 
  private:
+  using recordstream_type = detail::basic_recordstream<CharT, Traits>;
+
   /// \brief basic_logger object initialization time relative to epoch
   std::chrono::milliseconds m_start_time{current_time()};
 
-  /// \brief Mutex for basic_logstream object access
-  std::mutex mutable m_lstrm_mtx{};
+  /// \brief Sink records are written to, possibly shared with other loggers
+  std::shared_ptr<logsink_type> m_sink;
 
-  /// \brief basic_logstream object
-  logstream_type mutable m_lstrm;
+  /// \brief Name written with every record, may be empty
+  string_type m_name{};
 
   /// \brief Default logging level
   std::atomic<log_level> m_min_lvl_atm;
 
+  /// \brief Lowest level of error and fatal records that carry a stack trace
+  std::atomic<log_level> m_trace_lvl_atm{log_level::None};
+
  public:
   /// \brief Initializes basic_logger for console output
   /// \param lvl Sets default logging level
   basic_logger(log_level const lvl = default_lvl)
-      : m_lstrm{}, m_min_lvl_atm{lvl} {}
+      : m_sink{std::make_shared<logsink_type>()}, m_min_lvl_atm{lvl} {
+    detail::register_logger(this);
+  }
 
-  /// \brief Initializes basic_logger for file output
+  /// \brief Initializes basic_logger for file output, sharing the sink of
+  /// any other logger writing to the same file
   /// \param lvl Sets default logging level
   /// \param filepath Path to output file
   IMPLICIT basic_logger(log_level const lvl, path_type const& filepath)
-      : m_lstrm{filepath}, m_min_lvl_atm{lvl} {}
+      : m_sink{logsink_type::shared(filepath)}, m_min_lvl_atm{lvl} {
+    detail::register_logger(this);
+  }
 
-  /// \brief Initializes basic_logger for file output
+  /// \brief Initializes basic_logger for file output, sharing the sink of
+  /// any other logger writing to the same file
   /// \param filepath Path to output file
   /// \param lvl Sets default logging level
   IMPLICIT
   basic_logger(path_type const& filepath, log_level const lvl = default_lvl)
-      : m_lstrm{filepath}, m_min_lvl_atm{lvl} {}
+      : m_sink{logsink_type::shared(filepath)}, m_min_lvl_atm{lvl} {
+    detail::register_logger(this);
+  }
+
+  /// \brief Initializes a named basic_logger writing to an existing sink
+  /// \param sink Sink shared with other loggers
+  /// \param name Name written with every record
+  /// \param lvl Sets default logging level
+  basic_logger(std::shared_ptr<logsink_type> sink, string_type name,
+               log_level const lvl = default_lvl)
+      : m_sink{std::move(sink)}, m_name{std::move(name)}, m_min_lvl_atm{lvl} {
+    assert(m_sink != nullptr);
+    detail::register_logger(this);
+  }
 
   basic_logger(basic_logger const&) = delete;
 
-  basic_logger(basic_logger&&) = default;
+  basic_logger(basic_logger&&) = delete;
 
   basic_logger& operator=(basic_logger const&) = delete;
 
-  basic_logger& operator=(basic_logger&&) = default;
+  basic_logger& operator=(basic_logger&&) = delete;
+
+  virtual ~basic_logger() { detail::unregister_logger(this); }
+
+  /// \brief Returns the sink records are written to
+  auto const& sink() const noexcept { return m_sink; }
 
-  virtual ~basic_logger() = default;
+  /// \brief Returns the name written with every record
+  auto const& name() const noexcept { return m_name; }
 
   /// \brief Returns basic_logstream object
-  constexpr auto& stream() const noexcept { return m_lstrm; }
+  constexpr auto& stream() const noexcept { return m_sink->stream(); }
+
+  /// \brief Returns a copyable handle to the logger, which must not outlive
+  /// it
+  auto handle() const noexcept { return basic_log_handle{*this}; }
 
   /// \brief Locks the basic_logstream mutex in the caller's scope
-  /// \returns std::unique_lock<decltype(m_lstrm_mtx)>
+  /// \returns std::unique_lock<std::timed_mutex>
   [[nodiscard]] auto lock_stream() const noexcept {
-    return std::unique_lock{m_lstrm_mtx};
+    return m_sink->lock_stream();
   }
 
   /// \brief Sets a new default logging level value
@@ -200,25 +3551,136 @@ class basic_logger {
   }
 
   /// \brief Returns the current logging level
-  constexpr auto min_log_level() const noexcept { return m_min_lvl_atm.load(); }
+  constexpr auto min_log_level() const noexcept {
+    return m_min_lvl_atm.load(std::memory_order_relaxed);
+  }
+
+  /// \brief Sets the lowest level of error and fatal records that carry a
+  /// stack trace of the calling thread
+  /// \param lvl slug::error, slug::fatal, or slug::none to disable traces
+  /// \returns *this
+  auto& stack_trace_level(log_level const lvl) noexcept {
+    m_trace_lvl_atm.store(std::max(lvl, slug::error));
+    return *this;
+  }
+
+  /// \brief Returns the lowest level of records that carry a stack trace
+  auto stack_trace_level() const noexcept { return m_trace_lvl_atm.load(); }
+
+  /// \brief Sets how long the sink's writer may make no progress before
+  /// callers stop waiting for it and apply the stall policy
+  /// \param timeout New stall timeout
+  /// \returns *this
+  auto& stall_timeout(std::chrono::milliseconds const timeout) noexcept {
+    m_sink->stall_timeout(timeout);
+    return *this;
+  }
+
+  /// \brief Returns the current stall timeout
+  auto stall_timeout() const noexcept { return m_sink->stall_timeout(); }
+
+  /// \brief Sets the action taken by callers once the sink's writer has
+  /// stalled
+  /// \param policy New stall policy
+  /// \returns *this
+  auto& on_stall(stall_policy const policy) noexcept {
+    m_sink->on_stall(policy);
+    return *this;
+  }
+
+  /// \brief Returns the current stall policy
+  auto on_stall() const noexcept { return m_sink->on_stall(); }
+
+  /// \brief Checks if the sink's writer is currently considered stalled
+  bool stalled() const noexcept { return m_sink->stalled(); }
+
+  /// \brief Returns the number of records dropped by a stalled writer
+  auto dropped_count() const noexcept { return m_sink->dropped_count(); }
+
+  /// \brief Returns the last error of the sink's output stream
+  auto status() const { return m_sink->status(); }
+
+  /// \brief Sets the output buffer size of the sink
+  /// \param size Buffer size in characters
+  /// \returns *this
+  auto const& buffer_size(std::size_t const size) const {
+    m_sink->buffer_size(size);
+    return *this;
+  }
+
+  /// \brief Returns the output buffer size in characters
+  auto buffer_size() const { return m_sink->buffer_size(); }
 
-  /// \brief Opens a file for output
+  /// \brief Returns the memory held by the sink's buffers and the record
+  /// buffers of all threads
+  auto memory_used() const {
+    auto usage = m_sink->memory_used();
+    usage.record_buffers = recordstream_type::recordbuf_type::used_bytes();
+    return usage;
+  }
+
+  /// \brief Opens a file for output in the sink, which affects every logger
+  /// sharing it
   /// \param filepath Path to output file
   /// \returns *this
   auto const& open_file(path_type const& filepath) const {
-    auto l{lock_stream()};
-    m_lstrm.open(filepath);
+    m_sink->open_file(filepath);
+    return *this;
+  }
+
+  /// \brief Opens a file shared with other processes for output in the sink,
+  /// which affects every logger sharing it
+  /// \param filepath Path to output file
+  /// \param max_write Largest single write in bytes
+  /// \param oversize Handling of records larger than max_write
+  /// \returns *this
+  auto const& open_shared_file(
+      path_type const& filepath,
+      std::size_t const max_write = default_atomic_write,
+      oversize_policy const oversize = oversize_policy::Split) const {
+    m_sink->open_shared_file(filepath, max_write, oversize);
+    return *this;
+  }
+
+  /// \brief Opens a file for compressed output in the sink, which affects
+  /// every logger sharing it
+  /// \param filepath Path to output file
+  /// \param block_size Size of independently compressed blocks in
+  /// characters
+  /// \param level Compression level from 1 to 9
+  /// \param codec Compression codec
+  /// \returns *this
+  auto const& open_compressed_file(
+      path_type const& filepath,
+      std::size_t const block_size = default_compress_block,
+      int const level = default_compress_level,
+      compression_codec const codec = compression_codec::Auto) const {
+    m_sink->open_compressed_file(filepath, block_size, level, codec);
     return *this;
   }
 
   /// \brief Closes the currount output file and switches to console output
   /// \returns *this
   auto const& close_file() const {
-    auto l{lock_stream()};
-    m_lstrm.close();
+    m_sink->close_file();
+    return *this;
+  }
+
+  /// \brief Flushes the sink
+  /// \returns *this
+  auto const& flush() const {
+    m_sink->flush();
     return *this;
   }
 
+  /// \brief Opens a file for output while the writer is stalled, which is
+  /// used with stall_policy::Fallback instead of console output
+  /// \param filepath Path to fallback output file
+  /// \returns *this
+  auto const& open_fallback_file(path_type const& filepath) const {
+    m_sink->open_fallback_file(filepath);
+    return *this;
+  }
   /// \brief Logs fatal message(s) to sink
   /// \tparam Ts Template parameter pack of message types
   /// \param msgs Function parameter pack of messages to log
@@ -226,9 +3688,11 @@ class basic_logger {
   template <typename... Ts>
   auto const& fatal(Ts&&... msgs) const {
     if (slug::fatal >= m_min_lvl_atm.load()) {
-      auto l{lock_stream()};
-      m_lstrm << msg_prefix() << "FATAL: ";
-      (m_lstrm << ... << std::forward<Ts>(msgs)) << std::endl;
+      if (slug::fatal >= m_trace_lvl_atm.load())
+        write_record(nullptr, slug::fatal, std::forward<Ts>(msgs)...,
+                     stack_trace{});
+      else
+        write_record(nullptr, slug::fatal, std::forward<Ts>(msgs)...);
     }
     return *this;
   }
@@ -240,9 +3704,11 @@ class basic_logger {
   template <typename... Ts>
   auto const& error(Ts&&... msgs) const {
     if (slug::error >= m_min_lvl_atm.load()) {
-      auto l{lock_stream()};
-      m_lstrm << msg_prefix() << "ERROR: ";
-      (m_lstrm << ... << std::forward<Ts>(msgs)) << std::endl;
+      if (slug::error >= m_trace_lvl_atm.load())
+        write_record(nullptr, slug::error, std::forward<Ts>(msgs)...,
+                     stack_trace{});
+      else
+        write_record(nullptr, slug::error, std::forward<Ts>(msgs)...);
     }
     return *this;
   }
@@ -253,11 +3719,8 @@ class basic_logger {
   /// \returns *this
   template <typename... Ts>
   auto const& warning(Ts&&... msgs) const {
-    if (slug::warn >= m_min_lvl_atm.load()) {
-      auto l{lock_stream()};
-      m_lstrm << msg_prefix() << "WARN:  ";
-      (m_lstrm << ... << std::forward<Ts>(msgs)) << std::endl;
-    }
+    if (slug::warn >= m_min_lvl_atm.load())
+      write_record(nullptr, slug::warn, std::forward<Ts>(msgs)...);
     return *this;
   }
 
@@ -267,11 +3730,8 @@ class basic_logger {
   /// \returns *this
   template <typename... Ts>
   auto const& info(Ts&&... msgs) const {
-    if (slug::info >= m_min_lvl_atm.load()) {
-      auto l{lock_stream()};
-      m_lstrm << msg_prefix() << "INFO:  ";
-      (m_lstrm << ... << std::forward<Ts>(msgs)) << std::endl;
-    }
+    if (slug::info >= m_min_lvl_atm.load())
+      write_record(nullptr, slug::info, std::forward<Ts>(msgs)...);
     return *this;
   }
 
@@ -281,10 +3741,26 @@ class basic_logger {
   /// \returns *this
   template <typename... Ts>
   auto const& trace(Ts&&... msgs) const {
-    if (slug::trace >= m_min_lvl_atm.load()) {
-      auto l{lock_stream()};
-      m_lstrm << msg_prefix() << "TRACE: ";
-      (m_lstrm << ... << std::forward<Ts>(msgs)) << std::endl;
+    if (slug::trace >= m_min_lvl_atm.load())
+      write_record(nullptr, slug::trace, std::forward<Ts>(msgs)...);
+    return *this;
+  }
+
+  /// \brief Logs message(s) at the level of a call site, counting them in
+  /// its statistics; used by the SLUG_INFO family of macros
+  /// \tparam Ts Template parameter pack of message types
+  /// \param site Call site of the log statement
+  /// \param msgs Function parameter pack of messages to log
+  /// \returns *this
+  template <typename... Ts>
+  auto const& log(call_site const& site, Ts&&... msgs) const {
+    auto const lvl = site.level();
+    if (lvl >= slug::none || lvl < m_min_lvl_atm.load()) {
+      detail::count_suppressed(site);
+    } else if (lvl >= m_trace_lvl_atm.load()) {
+      write_record(&site, lvl, std::forward<Ts>(msgs)..., stack_trace{});
+    } else {
+      write_record(&site, lvl, std::forward<Ts>(msgs)...);
     }
     return *this;
   }
@@ -293,10 +3769,7 @@ class basic_logger {
   /// \returns basic_string<CharT, Traits>
   string_type msg_prefix() const {
     auto sstrm = stringstream_type{std::ios_base::out};
-
-    sstrm << '[' << std::setw(5) << std::this_thread::get_id() << ',' << ' ';
-    sstrm << std::fixed << std::setprecision(3) << elapsed_time() << "] ";
-
+    write_prefix(sstrm);
     return sstrm.str();
   }
 
@@ -319,12 +3792,296 @@ class basic_logger {
   /// \brief Swap implementation
   void swap(basic_logger& rhs) {
     if (this != std::addressof(rhs)) {
-      auto l{lock_stream()};
-      auto lr{rhs.lock_stream()};
       std::swap(m_start_time, rhs.m_start_time);
-      m_lstrm.swap(rhs.m_lstrm);
+      std::swap(m_sink, rhs.m_sink);
+      std::swap(m_name, rhs.m_name);
       m_min_lvl_atm.store(rhs.m_min_lvl_atm.exchange(m_min_lvl_atm.load()));
+      m_trace_lvl_atm.store(
+          rhs.m_trace_lvl_atm.exchange(m_trace_lvl_atm.load()));
+    }
+  }
+
+ private:
+  /// \brief Formats a single record on the calling thread and writes it to
+  /// the sink
+  /// \param site Call site counting the record, nullptr if there is none
+  /// \param lvl Logging level of the record
+  /// \param msgs Function parameter pack of messages to log
+  template <typename... Ts>
+  void write_record(call_site const* const site, log_level const lvl,
+                    Ts&&... msgs) const {
+    auto const format = m_sink->format();
+    if constexpr (detail::is_fixed_record<Ts...>) {
+      if (format == record_format::Text &&
+          write_fixed_record(site, lvl, msgs...)) {
+        return;
+      }
+    }
+
+    auto const lease = typename recordstream_type::lease{};
+    auto& rec = *lease;
+
+    auto const limit = m_sink->record_limit();
+    auto const truncate =
+        limit != 0 && format != record_format::Otlp &&
+        m_sink->on_long_record() == long_record_policy::Truncate;
+    if (truncate) rec.limit(limit);
+
+    if (format == record_format::Logfmt) {
+      write_logfmt(rec, lvl, msgs...);
+    } else if (format == record_format::Otlp) {
+      write_otlp(rec, lvl, msgs...);
+    } else {
+      write_prefix(rec);
+      rec.reset_format();
+      rec << level_label(lvl);
+      if (!m_name.empty()) rec << '[' << m_name << "] ";
+      (rec << ... << loggable(std::forward<Ts>(msgs))) << '\n';
+    }
+
+    if (truncate && rec.discarded() != 0) {
+      // The newline ending the record is always among the discarded
+      auto const discarded = rec.discarded() - 1;
+      rec.limit(recordstream_type::recordbuf_type::no_limit);
+      if (format == record_format::Logfmt)
+        rec << " truncated=" << discarded << '\n';
+      else
+        rec << "... [" << discarded << " characters truncated]\n";
+    }
+
+    publish(site, lvl, rec.view());
+  }
+
+  /// \brief Formats a record as logfmt: the elapsed time, thread, level,
+  /// and logger name, then the messages other than fields joined under
+  /// "msg", then each field under its own key
+  template <typename... Ts>
+  void write_logfmt(recordstream_type& rec, log_level const lvl,
+                    Ts const&... msgs) const {
+    constexpr char const* levels[] = {"trace", "info", "warn", "error",
+                                      "fatal"};
+    auto const ms = (current_time() - m_start_time).count();
+    auto const& tid = thread_label();
+
+    rec << "elapsed=" << ms / 1000 << '.' << std::setfill(rec.widen('0'))
+        << std::setw(3) << ms % 1000;
+    rec.reset_format();
+    rec << " thread=" << tid.c_str() + tid.find_first_not_of(' ')
+        << " level=" << levels[static_cast<std::size_t>(lvl)];
+    if (!m_name.empty()) {
+      rec << " logger=";
+      auto const pos = rec.view().size();
+      rec << m_name;
+      rec.quote_from(pos);
+    }
+
+    rec << " msg=";
+    auto const msg_pos = rec.view().size();
+    auto const write_msg = [&](auto const& msg) {
+      using msg_type = std::decay_t<decltype(msg)>;
+      if constexpr (!detail::is_field<msg_type>::value) rec << loggable(msg);
+    };
+    (write_msg(msgs), ...);
+    rec.quote_from(msg_pos);
+
+    auto const write_field = [&](auto const& msg) {
+      using msg_type = std::decay_t<decltype(msg)>;
+      if constexpr (detail::is_field<msg_type>::value) {
+        rec << ' ';
+        msg.key.write(rec);
+        rec << '=';
+        auto const pos = rec.view().size();
+        rec << loggable(msg.value);
+        rec.quote_from(pos);
+      }
+    };
+    (write_field(msgs), ...);
+    rec << '\n';
+  }
+
+  /// \brief Formats a record as a line of OTLP JSON holding a single log
+  /// record: the messages other than fields form the body, and the thread,
+  /// logger name, and fields become attributes
+  template <typename... Ts>
+  void write_otlp(recordstream_type& rec, log_level const lvl,
+                  Ts const&... msgs) const {
+    constexpr char const* levels[] = {"TRACE", "INFO", "WARN", "ERROR",
+                                      "FATAL"};
+    namespace chr = std::chrono;
+    auto const now = chr::duration_cast<chr::nanoseconds>(
+                         chr::system_clock::now().time_since_epoch())
+                         .count();
+    auto const& tid = thread_label();
+    auto const index = static_cast<std::size_t>(lvl);
+
+    rec << R"({"resourceLogs":[{"resource":{},"scopeLogs":[{"scope":)"
+        << R"({"name":"slug"},"logRecords":[{"timeUnixNano":")" << now
+        << R"(","observedTimeUnixNano":")" << now << R"(","severityNumber":)"
+        << +otel_severity[index] << R"(,"severityText":")" << levels[index]
+        << R"(","body":{"stringValue":")";
+    auto const body_pos = rec.view().size();
+    auto const write_msg = [&](auto const& msg) {
+      using msg_type = std::decay_t<decltype(msg)>;
+      if constexpr (!detail::is_field<msg_type>::value) rec << loggable(msg);
+    };
+    (write_msg(msgs), ...);
+    rec.escape_from(body_pos);
+
+    rec << R"("},"attributes":[{"key":"thread.id","value":{"stringValue":")"
+        << tid.c_str() + tid.find_first_not_of(' ') << R"("}})";
+    if (!m_name.empty()) {
+      rec << R"(,{"key":"logger.name","value":{"stringValue":")";
+      auto const pos = rec.view().size();
+      rec << m_name;
+      rec.escape_from(pos);
+      rec << R"("}})";
+    }
+
+    auto const write_field = [&](auto const& msg) {
+      using msg_type = std::decay_t<decltype(msg)>;
+      if constexpr (detail::is_field<msg_type>::value) {
+        rec << R"(,{"key":")";
+        auto const pos = rec.view().size();
+        rec << msg.key.name();
+        rec.escape_from(pos);
+        rec << R"(","value":)";
+        write_otlp_value(rec, msg.value);
+        rec << '}';
+      }
+    };
+    (write_field(msgs), ...);
+    rec << "]}]}]}]}\n";
+  }
+
+  /// \brief Writes an OTLP attribute value of the type matching a field
+  /// value: booleans, integers, and finite floating-point numbers keep their
+  /// type, everything else is written as a string
+  template <typename T>
+  void write_otlp_value(recordstream_type& rec, T const& value) const {
+    if constexpr (std::is_same_v<T, bool>) {
+      rec << (value ? R"({"boolValue":true})" : R"({"boolValue":false})");
+    } else if constexpr (std::is_integral_v<T> &&
+                         detail::fixed_msg_size<T>() > 1) {
+      // 64-bit integers are strings in the JSON encoding of protobuf
+      rec << R"({"intValue":")" << value << R"("})";
+    } else if constexpr (std::is_floating_point_v<T>) {
+      if (value - value == 0) {
+        rec << R"({"doubleValue":)"
+            << std::setprecision(std::numeric_limits<T>::max_digits10)
+            << value << '}';
+        rec.reset_format();
+      } else {
+        rec << R"({"stringValue":")" << value << R"("})";
+      }
+    } else {
+      rec << R"({"stringValue":")";
+      auto const pos = rec.view().size();
+      rec << loggable(value);
+      rec.escape_from(pos);
+      rec << R"("})";
+    }
+  }
+
+  /// \brief Returns the label following the message prefix of a level
+  static constexpr char const* level_label(log_level const lvl) noexcept {
+    constexpr char const* labels[] = {"TRACE: ", "INFO:  ", "WARN:  ",
+                                      "ERROR: ", "FATAL: "};
+    return labels[static_cast<std::size_t>(lvl)];
+  }
+
+  /// \brief Writes a formatted record to the sink, counting it in the
+  /// statistics of its call site if there is one
+  void publish(call_site const* const site, log_level const lvl,
+               typename logsink_type::view_type const record) const {
+    auto const written = m_sink->write(record, lvl, site);
+    if (site != nullptr)
+      detail::count_call_site(*site, record.size() * sizeof(CharT), written);
+  }
+
+  /// \brief Formats a record of messages accepted by detail::fixed_msg_size
+  /// into a buffer on the stack, without a stream, and writes it to the sink
+  /// \returns false if the record must be formatted by a stream instead,
+  /// because the logger name does not fit or the record needs truncation
+  template <typename... Ts>
+  bool write_fixed_record(call_site const* const site, log_level const lvl,
+                          Ts const&... msgs) const {
+    static constexpr auto const name_size = std::size_t{32};
+    auto buf = std::array<CharT, max_prefix_size + max_label_size +
+                                     name_size +
+                                     detail::fixed_record_size<Ts...> + 1>{};
+
+    if (m_name.size() + 3 > name_size) return false;
+
+    auto* out = write_prefix(buf.data());
+    auto const* const label = level_label(lvl);
+    out = detail::copy_chars(out, label, std::char_traits<char>::length(label));
+    if (!m_name.empty()) {
+      *out++ = CharT('[');
+      out = std::copy(m_name.begin(), m_name.end(), out);
+      *out++ = CharT(']');
+      *out++ = CharT(' ');
+    }
+    ((out = detail::write_fixed_msg(out, msgs)), ...);
+    *out++ = CharT('\n');
+
+    auto const size = static_cast<std::size_t>(out - buf.data());
+    if (auto const limit = m_sink->record_limit();
+        limit != 0 && size > limit &&
+        m_sink->on_long_record() == long_record_policy::Truncate) {
+      return false;
     }
+
+    publish(site, lvl, {buf.data(), size});
+    return true;
+  }
+
+  /// \brief Maximum size of the message prefix in characters
+  static constexpr auto const max_prefix_size = std::size_t{64};
+
+  /// \brief Maximum size of a level label in characters
+  static constexpr auto const max_label_size = std::size_t{8};
+
+  /// \brief Returns the calling thread's id as written in the message prefix,
+  /// formatted once per thread
+  static std::string const& thread_label() {
+    static thread_local auto const label = [] {
+      auto sstrm = std::ostringstream{};
+      sstrm << std::setw(5) << std::this_thread::get_id();
+      return sstrm.str().substr(0, 32);
+    }();
+    return label;
+  }
+
+  /// \brief Writes the message prefix for a log entry to a buffer of at
+  /// least max_prefix_size characters
+  /// \returns End of the prefix
+  CharT* write_prefix(CharT* out) const {
+    auto const& tid = thread_label();
+    auto const ms = (current_time() - m_start_time).count();
+    auto const frac = ms % 1000;
+
+    *out++ = CharT('[');
+    out = detail::copy_chars(out, tid.data(), tid.size());
+    out = detail::copy_chars(out, ", ", 2);
+    out = detail::write_fixed_msg(out, ms / 1000);
+    *out++ = CharT('.');
+    *out++ = CharT('0' + frac / 100);
+    *out++ = CharT('0' + frac / 10 % 10);
+    *out++ = CharT('0' + frac % 10);
+    return detail::copy_chars(out, "] ", 2);
+  }
+
+  /// \brief Writes the message prefix for a log entry
+  template <typename OStream>
+  void write_prefix(OStream& os) const {
+    CharT buf[max_prefix_size];
+    os.write(buf, write_prefix(buf) - buf);
+  }
+
+  /// \brief Prepares a message for writing to logstream_type
+  template <typename T>
+  static constexpr decltype(auto) loggable(T&& msg) noexcept {
+    return detail::loggable<logstream_type>(std::forward<T>(msg));
   }
 };  // ^ basic_logger ^
 
@@ -344,6 +4101,13 @@ using u16logger = basic_logger<char16_t, std::char_traits<char16_t>,
 using u32logger = basic_logger<char32_t, std::char_traits<char32_t>,
                                std::allocator<char32_t>>;
 
+using log_handle = basic_log_handle<logger>;
+using wlog_handle = basic_log_handle<wlogger>;
+using u16log_handle = basic_log_handle<u16logger>;
+using u32log_handle = basic_log_handle<u32logger>;
+
+static_assert(std::is_trivially_copyable_v<log_handle>);
+
 #ifdef SLUG_LOG
 extern logger g_logger;
 #endif
@@ -360,6 +4124,145 @@ extern u16logger g_u16logger;
 extern u32logger g_u32logger;
 #endif
 
+namespace detail {
+
+/// \brief Marks the end of the messages of a SLUG_CHECK, so the macro
+/// always passes at least one argument after the condition
+struct check_end {};
+
+/// \brief Call-site information of a failed SLUG_CHECK
+/// \tparam Logger basic_logger type the failure is reported through
+template <typename Logger>
+class check_failure {
+  Logger const& m_logger;
+  char const* const m_file;
+  int const m_line;
+  char const* const m_expr;
+
+ public:
+  check_failure(Logger const& logger, char const* const file, int const line,
+                char const* const expr) noexcept
+      : m_logger{logger}, m_file{file}, m_line{line}, m_expr{expr} {}
+
+  /// \brief Logs the failure as a fatal record, flushes every sink, and
+  /// aborts
+  /// \param args Messages to log followed by check_end
+  template <typename... Ts>
+  [[noreturn]] SLUG_COLD void operator()(Ts&&... args) const {
+    fail(std::forward_as_tuple(std::forward<Ts>(args)...),
+         std::make_index_sequence<sizeof...(Ts) - 1>{});
+  }
+
+ private:
+  /// \brief Logs the messages at indices Is, leaving out check_end
+  template <typename Tuple, std::size_t... Is>
+  [[noreturn]] void fail(Tuple&& msgs, std::index_sequence<Is...>) const {
+    if constexpr (sizeof...(Is) == 0) {
+      m_logger.fatal(m_file, ':', m_line, ": check failed: ", m_expr);
+    } else {
+      m_logger.fatal(m_file, ':', m_line, ": check failed: ", m_expr, ": ",
+                     std::get<Is>(std::forward<Tuple>(msgs))...);
+    }
+    flush_all();
+    std::abort();
+  }
+};  // ^ check_failure ^
+
+}  // namespace detail
+
 }  // namespace slug
 
+#ifndef SLUG_CHECK_LOGGER
+#define SLUG_CHECK_LOGGER ::slug::g_logger
+#endif
+
+/// \brief Aborts with a fatal record if cond is false, after flushing
+/// every sink; the failure path is out of line so a passing check costs
+/// only the comparison
+/// \note Used as SLUG_CHECK(cond) or SLUG_CHECK(cond, msgs...)
+#define SLUG_CHECK(...) SLUG_CHECK_(__VA_ARGS__, ::slug::detail::check_end{})
+#define SLUG_CHECK_(cond, ...)                                          \
+  (SLUG_LIKELY(cond) ? (void)0                                          \
+                     : ::slug::detail::check_failure{SLUG_CHECK_LOGGER, \
+                                                     __FILE__, __LINE__, \
+                                                     #cond}(__VA_ARGS__))
+
+#define SLUG_STRINGIFY_(x) #x
+#define SLUG_STRINGIFY(x) SLUG_STRINGIFY_(x)
+
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+/// \brief Emits the static descriptor of a log statement into the
+/// "slug_catalog" section, where program_catalog and read_catalog find it;
+/// lvl must be a constant expression
+/// \note The descriptor is assembled directly, as GCC rejects variables of
+/// inline and non-inline functions sharing a named section. Inlined or
+/// duplicated statements emit duplicates, which the readers drop.
+#define SLUG_CATALOG_ENTRY(lvl, ...)                                         \
+  do {                                                                      \
+    using slug_catalog_types_ =                                             \
+        decltype(::slug::detail::catalog_args(__VA_ARGS__));                \
+    __asm__ volatile(                                                       \
+        ".pushsection slug_catalog,\"a\"\n"                                  \
+        ".balign 8\n"                                                       \
+        "0:\n"                                                              \
+        ".long 0x43474c53, 1f - 0b, " SLUG_STRINGIFY(__LINE__) "\n"         \
+        ".byte %c0\n"                                                       \
+        ".balign 8\n"                                                       \
+        ".asciz \"" __FILE__ "\"\n"                                         \
+        ".byte %c1, %c2, %c3, %c4, %c5, %c6, %c7, %c8\n"                     \
+        ".byte %c9, %c10, %c11, %c12, %c13, %c14, %c15, %c16, 0\n"           \
+        ".balign 8\n"                                                       \
+        "1:\n"                                                              \
+        ".popsection\n" ::"i"(static_cast<int>(lvl)),                       \
+        SLUG_CATALOG_CODES_(slug_catalog_types_));                          \
+  } while (false)
+
+#define SLUG_CATALOG_CODES_(types)                                        \
+  "i"(::slug::detail::catalog_code<types, 0>),                            \
+      "i"(::slug::detail::catalog_code<types, 1>),                        \
+      "i"(::slug::detail::catalog_code<types, 2>),                        \
+      "i"(::slug::detail::catalog_code<types, 3>),                        \
+      "i"(::slug::detail::catalog_code<types, 4>),                        \
+      "i"(::slug::detail::catalog_code<types, 5>),                        \
+      "i"(::slug::detail::catalog_code<types, 6>),                        \
+      "i"(::slug::detail::catalog_code<types, 7>),                        \
+      "i"(::slug::detail::catalog_code<types, 8>),                        \
+      "i"(::slug::detail::catalog_code<types, 9>),                        \
+      "i"(::slug::detail::catalog_code<types, 10>),                       \
+      "i"(::slug::detail::catalog_code<types, 11>),                       \
+      "i"(::slug::detail::catalog_code<types, 12>),                       \
+      "i"(::slug::detail::catalog_code<types, 13>),                       \
+      "i"(::slug::detail::catalog_code<types, 14>),                       \
+      "i"(::slug::detail::catalog_code<types, 15>)
+#else
+#define SLUG_CATALOG_ENTRY(lvl, ...) static_cast<void>(0)
+#endif
+
+/// \brief Logs message(s) at lvl through logger, counting them in the
+/// statistics of the statement's call site and describing the statement in
+/// the catalog
+#define SLUG_LOG_AT(logger, lvl, ...)                                   \
+  do {                                                                  \
+    SLUG_CATALOG_ENTRY(lvl, __VA_ARGS__);                               \
+    static ::slug::call_site const slug_call_site_{__FILE__, __LINE__,  \
+                                                   lvl};                \
+    (logger).log(slug_call_site_, __VA_ARGS__);                         \
+  } while (false)
+
+#define SLUG_FATAL(logger, ...) \
+  SLUG_LOG_AT(logger, ::slug::fatal, __VA_ARGS__)
+#define SLUG_ERROR(logger, ...) \
+  SLUG_LOG_AT(logger, ::slug::error, __VA_ARGS__)
+#define SLUG_WARN(logger, ...) SLUG_LOG_AT(logger, ::slug::warn, __VA_ARGS__)
+#define SLUG_INFO(logger, ...) SLUG_LOG_AT(logger, ::slug::info, __VA_ARGS__)
+#define SLUG_TRACE(logger, ...) \
+  SLUG_LOG_AT(logger, ::slug::trace, __VA_ARGS__)
+
+/// \brief SLUG_CHECK in debug builds, compiled out with NDEBUG
+#ifndef NDEBUG
+#define SLUG_DCHECK(...) SLUG_CHECK(__VA_ARGS__)
+#else
+#define SLUG_DCHECK(...) (true ? (void)0 : SLUG_CHECK(__VA_ARGS__))
+#endif
+
 #endif  // SLUG_HEADER
@@ -1,5 +1,54 @@
 #include <slug.hpp>
 
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#define SLUG_POSIX
+#endif
+
+#if __has_include(<execinfo.h>) && __has_include(<dlfcn.h>)
+#include <dlfcn.h>
+#include <execinfo.h>
+#define SLUG_BACKTRACE
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#define SLUG_INOTIFY
+#endif
+
+#ifdef SLUG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+// Defined by the linker if any object has a slug_catalog section
+extern "C" char const __start_slug_catalog[] __attribute__((weak));
+extern "C" char const __stop_slug_catalog[] __attribute__((weak));
+#define SLUG_CATALOG
+#endif
+
+#if __has_include(<elf.h>)
+#include <elf.h>
+#define SLUG_ELF
+#endif
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#define SLUG_DEMANGLE
+#endif
+
 namespace slug {
 
 #ifdef SLUG_LOG
@@ -18,4 +67,1419 @@ inline u16logger g_u16logger{};
 inline u32logger g_u32logger{};
 #endif
 
+namespace {
+
+/// \brief Writes errors and status notices to stderr
+void print_error(std::error_code const& ec, char const* const what) {
+  if (!ec) {
+    std::fprintf(stderr, "%s\n", what);
+    return;
+  }
+  std::fprintf(stderr, "%s: %s\n", what, ec.message().c_str());
+}
+
+/// \brief Current error handler
+auto g_error_handler = std::atomic<error_handler>{&print_error};
+
+}  // namespace
+
+error_handler set_error_handler(error_handler const handler) noexcept {
+  return g_error_handler.exchange(handler != nullptr ? handler : &print_error);
+}
+
+bool compression_supported() noexcept {
+#if defined(SLUG_POSIX) && defined(SLUG_HAVE_ZLIB)
+  return true;
+#else
+  return false;
+#endif
+}
+
+namespace detail {
+
+/// \brief Sinks flushed by flush_all
+struct sink_registry {
+  std::mutex mtx{};
+  std::unordered_map<void const*, void (*)(void const*)> sinks{};
+};
+
+/// \brief Returns the sink registry, which is never destroyed so sinks
+/// with static storage duration can unregister in any order
+sink_registry& sinks() {
+  static auto* const registry = new sink_registry{};
+  return *registry;
+}
+
+}  // namespace detail
+
+void flush_all() {
+  auto& registry = detail::sinks();
+  // Held while flushing so a sink being destroyed waits in unregister_sink
+  auto l = std::lock_guard{registry.mtx};
+  for (auto const& [sink, flush] : registry.sinks) flush(sink);
+}
+
+namespace detail {
+
+void report_error(std::error_code const& ec, char const* const what) noexcept {
+  g_error_handler.load()(ec, what);
+}
+
+std::uint64_t next_sink_id() noexcept {
+  static auto ids = std::atomic<std::uint64_t>{0};
+  return ids.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void register_sink(void const* const sink, void (*const flush)(void const*)) {
+  auto& registry = sinks();
+  auto l = std::lock_guard{registry.mtx};
+  registry.sinks.emplace(sink, flush);
+}
+
+void unregister_sink(void const* const sink) noexcept {
+  auto& registry = sinks();
+  auto l = std::lock_guard{registry.mtx};
+  registry.sinks.erase(sink);
+}
+
+namespace {
+
+/// \brief Addresses of the loggers that exist
+struct logger_registry {
+  std::mutex mtx{};
+  std::unordered_set<void const*> loggers{};
+};
+
+/// \brief Returns the logger registry, which is never destroyed so loggers
+/// with static storage duration can unregister in any order
+logger_registry& loggers() {
+  static auto* const registry = new logger_registry{};
+  return *registry;
+}
+
+}  // namespace
+
+void register_logger(void const* const logger) {
+  auto& registry = loggers();
+  auto l = std::lock_guard{registry.mtx};
+  registry.loggers.insert(logger);
+}
+
+void unregister_logger(void const* const logger) noexcept {
+  auto& registry = loggers();
+  auto l = std::lock_guard{registry.mtx};
+  registry.loggers.erase(logger);
+}
+
+bool logger_registered(void const* const logger) noexcept {
+  auto& registry = loggers();
+  auto l = std::lock_guard{registry.mtx};
+  return registry.loggers.count(logger) != 0;
+}
+
+namespace {
+
+/// \brief Per-thread record buffer counts and the total of exited threads
+struct record_bytes_registry {
+  std::mutex mtx{};
+  std::vector<std::atomic<std::ptrdiff_t> const*> threads{};
+  std::ptrdiff_t retired{0};
+};
+
+record_bytes_registry& record_bytes_threads() {
+  static auto* const registry = new record_bytes_registry{};
+  return *registry;
+}
+
+/// \brief Memory held by the record buffers of the calling thread, written
+/// by that thread only and negative if it freed buffers of other threads
+class thread_record_bytes {
+  std::atomic<std::ptrdiff_t> m_bytes{0};
+
+ public:
+  thread_record_bytes() {
+    auto& registry = record_bytes_threads();
+    auto l = std::lock_guard{registry.mtx};
+    registry.threads.push_back(&m_bytes);
+  }
+
+  ~thread_record_bytes() {
+    auto& registry = record_bytes_threads();
+    auto l = std::lock_guard{registry.mtx};
+    registry.retired += m_bytes.load(std::memory_order_relaxed);
+    registry.threads.erase(std::find(registry.threads.begin(),
+                                     registry.threads.end(), &m_bytes));
+  }
+
+  void add(std::ptrdiff_t const bytes) noexcept {
+    m_bytes.store(m_bytes.load(std::memory_order_relaxed) + bytes,
+                  std::memory_order_relaxed);
+  }
+};
+
+}  // namespace
+
+void count_record_bytes(std::ptrdiff_t const bytes) noexcept {
+  static thread_local auto local = thread_record_bytes{};
+  local.add(bytes);
+}
+
+std::size_t record_bytes() noexcept {
+  auto& registry = record_bytes_threads();
+  auto l = std::lock_guard{registry.mtx};
+  auto total = registry.retired;
+  for (auto const* const bytes : registry.threads)
+    total += bytes->load(std::memory_order_relaxed);
+  return static_cast<std::size_t>(std::max<std::ptrdiff_t>(total, 0));
+}
+
+std::error_code last_error() noexcept {
+  if (errno == 0) return std::make_error_code(std::io_errc::stream);
+  return {errno, std::generic_category()};
+}
+
+#ifdef SLUG_POSIX
+
+int open_append(std::filesystem::path const& filepath) noexcept {
+  constexpr auto flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+  int fd;
+  do fd = ::open(filepath.c_str(), flags, 0644);
+  while (fd == -1 && errno == EINTR);
+  return fd;
+}
+
+void close_append(int const fd) noexcept { ::close(fd); }
+
+bool write_append(int const fd, void const* data, std::size_t size) noexcept {
+  auto const* bytes = static_cast<char const*>(data);
+  while (size > 0) {
+    auto const n = ::write(fd, bytes, size);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    bytes += n;
+    size -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool lock_append(int const fd, bool const lock) noexcept {
+  int rc;
+  do rc = ::flock(fd, lock ? LOCK_EX : LOCK_UN);
+  while (rc == -1 && errno == EINTR);
+  return rc == 0;
+}
+
+#else
+
+int open_append(std::filesystem::path const&) noexcept { return -1; }
+
+void close_append(int) noexcept {}
+
+bool write_append(int, void const*, std::size_t) noexcept { return false; }
+
+bool lock_append(int, bool) noexcept { return false; }
+
+#endif
+
+namespace {
+
+/// \brief Magic bytes starting every block of compression_codec::Lz
+constexpr unsigned char lz_magic[4] = {'S', 'L', 'Z', '1'};
+
+/// \brief Size of the header of a block: magic, uncompressed size and
+/// compressed size as 32 bit little endian integers
+constexpr std::size_t lz_header_size = 12;
+
+/// \brief Largest block, which keeps every size in the header in 32 bits
+constexpr std::size_t lz_max_block = std::size_t{1} << 30;
+
+/// \brief Shortest match worth encoding
+constexpr std::size_t lz_min_match = 4;
+
+/// \brief Farthest match, offsets are encoded in 16 bits
+constexpr std::size_t lz_max_offset = 65535;
+
+/// \brief Number of bits of the match finder's hash
+constexpr unsigned lz_hash_bits = 14;
+
+/// \brief Returns the largest compressed size of a block
+constexpr std::size_t lz_bound(std::size_t const size) {
+  return size + size / 255 + 16;
+}
+
+/// \brief Reads a 32 bit little endian integer
+std::uint32_t load_le32(unsigned char const* const p) noexcept {
+  return std::uint32_t{p[0]} | std::uint32_t{p[1]} << 8 |
+         std::uint32_t{p[2]} << 16 | std::uint32_t{p[3]} << 24;
+}
+
+/// \brief Writes a 32 bit little endian integer
+void store_le32(unsigned char* const p, std::uint32_t const value) noexcept {
+  for (auto i = 0; i < 4; ++i)
+    p[i] = static_cast<unsigned char>(value >> 8 * i);
+}
+
+/// \brief Hashes the four bytes at p for the match finder
+std::uint32_t lz_hash(unsigned char const* const p) noexcept {
+  return (load_le32(p) * 2654435761u) >> (32 - lz_hash_bits);
+}
+
+/// \brief Writes the extension bytes of a length that does not fit the
+/// four bits of a token
+unsigned char* lz_put_length(unsigned char* out, std::size_t length) noexcept {
+  for (; length >= 255; length -= 255) *out++ = 255;
+  *out++ = static_cast<unsigned char>(length);
+  return out;
+}
+
+/// \brief Compresses a block into sequences of a token holding the literal
+/// and match lengths, the literals, and a 16 bit match offset; the last
+/// sequence has literals only
+/// \param table Match finder hash table of 1 << lz_hash_bits entries
+/// \returns Size of the compressed block, at most lz_bound(size)
+std::size_t lz_compress(unsigned char const* const in, std::size_t const size,
+                        unsigned char* out, std::uint32_t* const table) {
+  std::fill_n(table, std::size_t{1} << lz_hash_bits, 0);
+
+  auto const* const out_begin = out;
+  auto const* const end = in + size;
+  auto const* anchor = in;
+  auto const* p = in;
+
+  auto const put_sequence = [&](std::size_t const literals,
+                                std::size_t const match,
+                                std::size_t const offset) {
+    auto* const token = out++;
+    *token = static_cast<unsigned char>(std::min<std::size_t>(literals, 15)
+                                        << 4);
+    if (literals >= 15) out = lz_put_length(out, literals - 15);
+    out = std::copy_n(anchor, literals, out);
+    if (match == 0) return;
+
+    *out++ = static_cast<unsigned char>(offset);
+    *out++ = static_cast<unsigned char>(offset >> 8);
+    auto const extra = match - lz_min_match;
+    *token |= static_cast<unsigned char>(std::min<std::size_t>(extra, 15));
+    if (extra >= 15) out = lz_put_length(out, extra - 15);
+  };
+
+  while (size >= lz_min_match && p <= end - lz_min_match) {
+    auto& slot = table[lz_hash(p)];
+    auto const* const candidate = in + slot;
+    slot = static_cast<std::uint32_t>(p - in);
+
+    auto const offset = static_cast<std::size_t>(p - candidate);
+    if (offset == 0 || offset > lz_max_offset ||
+        load_le32(candidate) != load_le32(p)) {
+      ++p;
+      continue;
+    }
+
+    auto match = lz_min_match;
+    while (p + match < end && candidate[match] == p[match]) ++match;
+
+    put_sequence(static_cast<std::size_t>(p - anchor), match, offset);
+    p += match;
+    anchor = p;
+  }
+
+  put_sequence(static_cast<std::size_t>(end - anchor), 0, 0);
+  return static_cast<std::size_t>(out - out_begin);
+}
+
+/// \brief Decompresses a block written by lz_compress
+/// \returns false if the block is corrupt
+bool lz_decompress(unsigned char const* in, std::size_t const in_size,
+                   unsigned char* const out, std::size_t const out_size) {
+  auto const* const in_end = in + in_size;
+  auto* p = out;
+  auto* const out_end = out + out_size;
+
+  auto const get_length = [&](std::size_t length) {
+    if (length != 15) return length;
+    for (unsigned char byte = 255; byte == 255;) {
+      if (in == in_end) return out_size + 1;
+      byte = *in++;
+      length += byte;
+    }
+    return length;
+  };
+
+  while (in < in_end) {
+    auto const token = *in++;
+    auto const literals = get_length(token >> 4);
+    if (literals > static_cast<std::size_t>(in_end - in) ||
+        literals > static_cast<std::size_t>(out_end - p))
+      return false;
+    p = std::copy_n(in, literals, p);
+    in += literals;
+    if (in == in_end) break;
+
+    if (in_end - in < 2) return false;
+    auto const offset = std::size_t{in[0]} | std::size_t{in[1]} << 8;
+    in += 2;
+    auto const match = get_length(token & 15) + lz_min_match;
+    if (offset == 0 || offset > static_cast<std::size_t>(p - out) ||
+        match > static_cast<std::size_t>(out_end - p))
+      return false;
+    // An overlapping match repeats the bytes it is writing
+    auto const* const from = p - offset;
+    if (offset >= match) {
+      p = std::copy_n(from, match, p);
+    } else {
+      for (auto i = std::size_t{0}; i < match; ++i) *p++ = from[i];
+    }
+  }
+
+  return p == out_end;
+}
+
+}  // namespace
+
+#ifdef SLUG_POSIX
+
+struct compressed_file {
+  /// \brief File descriptor opened with open_append
+  int fd{-1};
+
+  /// \brief Codec the file is written with, never Auto
+  compression_codec codec{compression_codec::Lz};
+
+#ifdef SLUG_HAVE_ZLIB
+  /// \brief Deflate state
+  z_stream strm{};
+#endif
+
+  /// \brief Compressed output
+  std::vector<unsigned char> out{};
+
+  /// \brief Match finder hash table of the Lz codec
+  std::vector<std::uint32_t> table{};
+};
+
+namespace {
+
+#ifdef SLUG_HAVE_ZLIB
+
+/// \brief Runs deflate over the pending input until it is consumed and the
+/// flush is complete, writing the compressed output
+bool deflate_all(compressed_file& file, int const flush) noexcept {
+  auto& strm = file.strm;
+  for (;;) {
+    strm.next_out = file.out.data();
+    strm.avail_out = static_cast<uInt>(file.out.size());
+    auto const rc = ::deflate(&strm, flush);
+    if (rc == Z_STREAM_ERROR) return false;
+
+    auto const size = file.out.size() - strm.avail_out;
+    if (size > 0 && !write_append(file.fd, file.out.data(), size))
+      return false;
+
+    if (flush == Z_FINISH ? rc == Z_STREAM_END
+                          : strm.avail_in == 0 && strm.avail_out != 0)
+      return true;
+  }
+}
+
+/// \brief Compresses a block ending with a full flush, which ends the block
+/// on a byte boundary and resets the dictionary
+bool write_gzip(compressed_file& file, unsigned char const* data,
+                std::size_t size) noexcept {
+  auto& strm = file.strm;
+  for (;;) {
+    auto const chunk = static_cast<uInt>(
+        std::min<std::size_t>(size, std::numeric_limits<uInt>::max()));
+    strm.next_in = const_cast<Bytef*>(data);
+    strm.avail_in = chunk;
+    data += chunk;
+    size -= chunk;
+    if (!deflate_all(file, size == 0 ? Z_FULL_FLUSH : Z_NO_FLUSH))
+      return false;
+    if (size == 0) return true;
+  }
+}
+
+#endif
+
+/// \brief Writes a block with a header, compressed unless that would make
+/// it larger
+bool write_lz(compressed_file& file, unsigned char const* data,
+              std::size_t size) noexcept {
+  for (; size > 0;) {
+    auto const chunk = std::min(size, lz_max_block);
+    file.out.resize(lz_header_size + lz_bound(chunk));
+    auto* const payload = file.out.data() + lz_header_size;
+
+    auto packed = lz_compress(data, chunk, payload, file.table.data());
+    if (packed >= chunk) {
+      std::copy_n(data, chunk, payload);
+      packed = chunk;
+    }
+
+    std::copy_n(lz_magic, sizeof(lz_magic), file.out.data());
+    store_le32(file.out.data() + 4, static_cast<std::uint32_t>(chunk));
+    store_le32(file.out.data() + 8, static_cast<std::uint32_t>(packed));
+    if (!write_append(file.fd, file.out.data(), lz_header_size + packed))
+      return false;
+
+    data += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+}  // namespace
+
+compressed_file* open_compressed(std::filesystem::path const& filepath,
+                                 int const level,
+                                 compression_codec codec) noexcept {
+  if (codec == compression_codec::Auto) {
+    codec = compression_supported() ? compression_codec::Gzip
+                                    : compression_codec::Lz;
+  }
+
+#ifndef SLUG_HAVE_ZLIB
+  if (codec == compression_codec::Gzip) {
+    errno = ENOTSUP;
+    return nullptr;
+  }
+#endif
+
+  auto* const file = new (std::nothrow) compressed_file{};
+  if (file == nullptr) return nullptr;
+  file->codec = codec;
+
+#ifdef SLUG_HAVE_ZLIB
+  // Window bits above 15 select the gzip wrapper
+  constexpr auto gzip_window = 15 + 16;
+  if (codec == compression_codec::Gzip &&
+      ::deflateInit2(&file->strm, std::clamp(level, 1, 9), Z_DEFLATED,
+                     gzip_window, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    delete file;
+    errno = ENOMEM;
+    return nullptr;
+  }
+#else
+  static_cast<void>(level);
+#endif
+
+  if (codec == compression_codec::Gzip) {
+    file->out.resize(16384);
+  } else {
+    file->table.resize(std::size_t{1} << lz_hash_bits);
+  }
+
+  file->fd = open_append(filepath);
+  if (file->fd == -1) {
+    auto const error = errno;
+#ifdef SLUG_HAVE_ZLIB
+    if (codec == compression_codec::Gzip) ::deflateEnd(&file->strm);
+#endif
+    delete file;
+    errno = error;
+    return nullptr;
+  }
+
+  return file;
+}
+
+bool write_compressed(compressed_file* const file, void const* const data,
+                      std::size_t const size) noexcept {
+  auto const* const bytes = static_cast<unsigned char const*>(data);
+#ifdef SLUG_HAVE_ZLIB
+  if (file->codec == compression_codec::Gzip)
+    return write_gzip(*file, bytes, size);
+#endif
+  return write_lz(*file, bytes, size);
+}
+
+bool close_compressed(compressed_file* const file) noexcept {
+  auto ok = true;
+#ifdef SLUG_HAVE_ZLIB
+  if (file->codec == compression_codec::Gzip) {
+    file->strm.avail_in = 0;
+    ok = deflate_all(*file, Z_FINISH);
+    ::deflateEnd(&file->strm);
+  }
+#endif
+  close_append(file->fd);
+  delete file;
+  return ok;
+}
+
+#else
+
+struct compressed_file {};
+
+compressed_file* open_compressed(std::filesystem::path const&, int,
+                                 compression_codec) noexcept {
+  return nullptr;
+}
+
+bool write_compressed(compressed_file*, void const*, std::size_t) noexcept {
+  return false;
+}
+
+bool close_compressed(compressed_file*) noexcept { return false; }
+
+#endif
+
+std::size_t capture_stack(void** const frames, std::size_t const max_frames,
+                          std::size_t const skip) noexcept {
+#ifdef SLUG_BACKTRACE
+  void* buf[max_stack_frames + 16];
+  auto const want = std::min(max_frames + skip + 1, std::size(buf));
+  auto const n = static_cast<std::size_t>(::backtrace(buf, int(want)));
+  auto const first = std::min(n, skip + 1);
+  std::copy(buf + first, buf + n, frames);
+  return n - first;
+#else
+  (void)frames, (void)max_frames, (void)skip;
+  return 0;
+#endif
+}
+
+namespace {
+
+/// \brief Resolves a code address to "function+offset (module)"
+std::string describe_address(void const* const addr) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), "%p", addr);
+  auto desc = std::string{buf};
+
+#ifdef SLUG_BACKTRACE
+  auto info = Dl_info{};
+  if (::dladdr(addr, &info) == 0) return desc;
+
+  auto const* const pc = static_cast<char const*>(addr);
+  if (info.dli_sname != nullptr) {
+    auto const* name = info.dli_sname;
+#ifdef SLUG_DEMANGLE
+    auto status = 0;
+    auto const demangled = std::unique_ptr<char, decltype(&std::free)>{
+        abi::__cxa_demangle(name, nullptr, nullptr, &status), &std::free};
+    if (status == 0) name = demangled.get();
+#endif
+    std::snprintf(buf, sizeof(buf), "+%#tx",
+                  pc - static_cast<char const*>(info.dli_saddr));
+    desc += ' ';
+    desc += name;
+    desc += buf;
+  }
+
+  if (info.dli_fname != nullptr) {
+    std::snprintf(buf, sizeof(buf), "+%#tx)",
+                  pc - static_cast<char const*>(info.dli_fbase));
+    desc += " (";
+    desc += info.dli_fname;
+    desc += buf;
+  }
+#endif
+
+  return desc;
+}
+
+}  // namespace
+
+std::string const& symbolize(void const* const addr) {
+  static auto mtx = std::shared_mutex{};
+  static auto cache = std::unordered_map<void const*, std::string>{};
+
+  {
+    auto l{std::shared_lock{mtx}};
+    if (auto const it = cache.find(addr); it != cache.end()) return it->second;
+  }
+
+  // Resolved without the lock, so other threads keep reading the cache
+  auto desc = describe_address(addr);
+  auto l{std::unique_lock{mtx}};
+  return cache.try_emplace(addr, std::move(desc)).first->second;
+}
+
+namespace {
+
+/// \brief Number of record buffers available to signal_safe_log
+constexpr auto signal_record_count = std::size_t{8};
+
+/// \brief Record buffers of signal_safe_log
+alignas(64) char g_signal_records[signal_record_count][signal_record_size];
+
+/// \brief Flags marking record buffers in use
+std::atomic<bool> g_signal_records_busy[signal_record_count]{};
+
+/// \brief File descriptor signal_safe_log writes to
+std::atomic<int> g_signal_fd{2};
+
+/// \brief Number of records dropped by signal_safe_log
+std::atomic<std::uint64_t> g_signal_dropped{0};
+
+static_assert(std::atomic<bool>::is_always_lock_free &&
+                  std::atomic<int>::is_always_lock_free &&
+                  std::atomic<std::uint64_t>::is_always_lock_free,
+              "signal-safe logging requires lock-free atomics");
+
+}  // namespace
+
+char* acquire_signal_record() noexcept {
+  for (auto i = std::size_t{0}; i < signal_record_count; ++i) {
+    if (!g_signal_records_busy[i].exchange(true, std::memory_order_acquire))
+      return g_signal_records[i];
+  }
+  g_signal_dropped.fetch_add(1, std::memory_order_relaxed);
+  return nullptr;
+}
+
+void release_signal_record(char* const record) noexcept {
+  auto const i = static_cast<std::size_t>(record - g_signal_records[0]) /
+                 signal_record_size;
+  g_signal_records_busy[i].store(false, std::memory_order_release);
+}
+
+void write_signal_record(char const* const record,
+                         std::size_t const size) noexcept {
+  auto const saved_errno = errno;
+  write_append(g_signal_fd.load(std::memory_order_relaxed), record, size);
+  errno = saved_errno;
+}
+
+}  // namespace detail
+
+bool decompress_file(std::filesystem::path const& filepath, std::ostream& os,
+                     unsigned threads) {
+  auto in = std::ifstream{filepath, std::ios::binary};
+  if (!in) return false;
+  if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  struct block {
+    std::vector<unsigned char> data{};
+    std::string out{};
+    bool ok{};
+  };
+
+  // Blocks are read in batches so memory stays bounded for large files
+  auto batch = std::vector<block>(std::size_t{threads} * 4);
+  for (;;) {
+    auto count = std::size_t{0};
+    auto complete = true;
+    for (; count < batch.size(); ++count) {
+      unsigned char header[detail::lz_header_size];
+      if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) {
+        complete = in.gcount() == 0;
+        break;
+      }
+
+      auto const size = detail::load_le32(header + 4);
+      auto const packed = detail::load_le32(header + 8);
+      if (!std::equal(std::begin(detail::lz_magic), std::end(detail::lz_magic),
+                      header) ||
+          size > detail::lz_max_block || packed > detail::lz_bound(size)) {
+        complete = false;
+        break;
+      }
+
+      auto& blk = batch[count];
+      blk.data.resize(packed);
+      blk.out.resize(size);
+      if (!in.read(reinterpret_cast<char*>(blk.data.data()), packed)) {
+        complete = false;
+        break;
+      }
+    }
+
+    auto next = std::atomic<std::size_t>{0};
+    auto const decode = [&] {
+      for (auto i = next++; i < count; i = next++) {
+        auto& blk = batch[i];
+        auto* const out = reinterpret_cast<unsigned char*>(blk.out.data());
+        if (blk.data.size() == blk.out.size()) {
+          std::copy(blk.data.begin(), blk.data.end(), out);
+          blk.ok = true;
+        } else {
+          blk.ok = detail::lz_decompress(blk.data.data(), blk.data.size(), out,
+                                         blk.out.size());
+        }
+      }
+    };
+
+    auto workers = std::vector<std::thread>{};
+    for (auto t = std::size_t{1}; t < std::min<std::size_t>(threads, count);
+         ++t)
+      workers.emplace_back(decode);
+    decode();
+    for (auto& worker : workers) worker.join();
+
+    for (auto i = std::size_t{0}; i < count; ++i) {
+      if (!batch[i].ok) return false;
+      os.write(batch[i].out.data(),
+               static_cast<std::streamsize>(batch[i].out.size()));
+    }
+
+    if (!complete || !os) return false;
+    if (count < batch.size()) return true;
+  }
+}
+
+void signal_safe_fd(int const fd) noexcept {
+  detail::g_signal_fd.store(fd, std::memory_order_relaxed);
+}
+
+std::uint64_t signal_safe_dropped() noexcept {
+  return detail::g_signal_dropped.load(std::memory_order_relaxed);
+}
+
+namespace {
+
+/// \brief Counters of one call site on one thread, written by that thread
+/// only and read by collect_call_site_stats
+struct site_counters {
+  std::atomic<std::uint64_t> emitted{0};
+  std::atomic<std::uint64_t> suppressed{0};
+  std::atomic<std::uint64_t> dropped{0};
+  std::atomic<std::uint64_t> bytes{0};
+};
+
+/// \brief Adds to a counter owned by the calling thread
+void bump(std::atomic<std::uint64_t>& counter, std::uint64_t const n) {
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+/// \brief Number of call sites covered by a page of counters
+constexpr auto site_page_size = std::size_t{256};
+
+using site_page = std::array<site_counters, site_page_size>;
+
+/// \brief Registered call sites and the counters of every thread
+struct site_registry {
+  std::mutex mtx{};
+  std::vector<call_site const*> sites{};
+  std::vector<std::vector<std::unique_ptr<site_page>> const*> threads{};
+  std::vector<call_site_stats> retired{};
+  std::vector<std::uint64_t> batch_dropped{};
+};
+
+site_registry& registry() {
+  static auto reg = site_registry{};
+  return reg;
+}
+
+/// \brief Adds the counters of a thread to call site totals
+void add_counters(std::vector<std::unique_ptr<site_page>> const& pages,
+                  std::vector<call_site_stats>& totals) {
+  for (auto i = std::size_t{0}; i < totals.size(); ++i) {
+    if (i / site_page_size >= pages.size()) break;
+    auto const& c = (*pages[i / site_page_size])[i % site_page_size];
+    totals[i].emitted += c.emitted.load(std::memory_order_relaxed);
+    totals[i].suppressed += c.suppressed.load(std::memory_order_relaxed);
+    totals[i].dropped += c.dropped.load(std::memory_order_relaxed);
+    totals[i].bytes += c.bytes.load(std::memory_order_relaxed);
+  }
+}
+
+/// \brief Counters of the calling thread, allocated a page at a time as
+/// call sites are used and folded into the registry on thread exit
+class thread_site_counters {
+  std::vector<std::unique_ptr<site_page>> m_pages{};
+
+ public:
+  thread_site_counters() {
+    auto& reg = registry();
+    auto l = std::lock_guard{reg.mtx};
+    reg.threads.push_back(&m_pages);
+  }
+
+  ~thread_site_counters() {
+    auto& reg = registry();
+    auto l = std::lock_guard{reg.mtx};
+    reg.retired.resize(reg.sites.size());
+    add_counters(m_pages, reg.retired);
+    reg.threads.erase(
+        std::find(reg.threads.begin(), reg.threads.end(), &m_pages));
+  }
+
+  site_counters& operator[](std::size_t const index) {
+    auto const page = index / site_page_size;
+    if (page >= m_pages.size()) {
+      // Readers walk m_pages under the registry mutex
+      auto l = std::lock_guard{registry().mtx};
+      while (m_pages.size() <= page)
+        m_pages.push_back(std::make_unique<site_page>());
+    }
+    return (*m_pages[page])[index % site_page_size];
+  }
+};
+
+site_counters& local_counters(call_site const& site) {
+  static thread_local auto counters = thread_site_counters{};
+  return counters[site.index()];
+}
+
+}  // namespace
+
+call_site::call_site(char const* const file, unsigned const line,
+                     log_level const lvl)
+    : m_file{file}, m_line{line}, m_level{lvl} {
+  auto& reg = registry();
+  auto l = std::lock_guard{reg.mtx};
+  m_index = reg.sites.size();
+  reg.sites.push_back(this);
+}
+
+std::vector<call_site_stats> collect_call_site_stats() {
+  auto& reg = registry();
+  auto l = std::lock_guard{reg.mtx};
+
+  auto totals = reg.retired;
+  totals.resize(reg.sites.size());
+  for (auto i = std::size_t{0}; i < totals.size(); ++i)
+    totals[i].site = reg.sites[i];
+  for (auto const* pages : reg.threads) add_counters(*pages, totals);
+  for (auto i = std::size_t{0}; i < reg.batch_dropped.size(); ++i) {
+    totals[i].emitted -= reg.batch_dropped[i];
+    totals[i].dropped += reg.batch_dropped[i];
+  }
+  return totals;
+}
+
+std::vector<call_site_stats> top_call_sites(std::size_t const count) {
+  auto stats = collect_call_site_stats();
+  auto const by_bytes = [](call_site_stats const& lhs,
+                           call_site_stats const& rhs) {
+    return lhs.bytes > rhs.bytes;
+  };
+  auto const n = std::min(count, stats.size());
+  std::partial_sort(stats.begin(), stats.begin() + std::ptrdiff_t(n),
+                    stats.end(), by_bytes);
+  stats.resize(n);
+  return stats;
+}
+
+void dump_call_sites(std::ostream& os, std::size_t const count) {
+  os << "bytes emitted suppressed dropped level site\n";
+  for (auto const& stats : top_call_sites(count)) {
+    os << stats.bytes << ' ' << stats.emitted << ' ' << stats.suppressed << ' '
+       << stats.dropped << ' ' << enum_name(stats.site->level()) << ' '
+       << stats.site->file() << ':' << stats.site->line() << '\n';
+  }
+}
+
+namespace detail {
+
+void count_call_site(call_site const& site, std::size_t const bytes,
+                     bool const written) {
+  auto& counters = local_counters(site);
+  bump(written ? counters.emitted : counters.dropped, 1);
+  bump(counters.bytes, bytes);
+}
+
+void count_suppressed(call_site const& site) {
+  bump(local_counters(site).suppressed, 1);
+}
+
+void count_batch_dropped(std::vector<call_site const*> const& sites) {
+  // Batches can be dropped by any thread, including one that is exiting
+  // after its own counters are gone, so these go to the registry
+  auto& reg = registry();
+  auto l = std::lock_guard{reg.mtx};
+  reg.batch_dropped.resize(reg.sites.size());
+  for (auto const* const site : sites) ++reg.batch_dropped[site->index()];
+}
+
+}  // namespace detail
+
+namespace {
+
+/// \brief Parses the catalog entries in the contents of a catalog section,
+/// skipping the padding the linker inserts between objects and entries
+/// already in sites
+void parse_catalog(char const* const data, std::size_t const size,
+                   std::vector<catalog_site>& sites) {
+  constexpr auto step = alignof(catalog_entry);
+  for (auto pos = std::size_t{0}; pos + sizeof(catalog_entry) <= size;) {
+    auto entry = catalog_entry{};
+    std::memcpy(&entry, data + pos, sizeof(entry));
+    if (entry.magic != catalog_entry::entry_magic ||
+        entry.size <= sizeof(entry) || entry.size > size - pos) {
+      pos += step;
+      continue;
+    }
+
+    auto const* const end = data + pos + entry.size;
+    auto const* const file = data + pos + sizeof(entry);
+    auto const* const file_end = std::find(file, end, '\0');
+    auto const* const types_end =
+        file_end == end ? end : std::find(file_end + 1, end, '\0');
+    if (types_end == end) {
+      pos += step;
+      continue;
+    }
+
+    auto site = catalog_site{std::string(file, file_end), entry.line,
+                             entry.level, std::string(file_end + 1, types_end)};
+    auto const same = [&](catalog_site const& other) {
+      return other.line == site.line && other.level == site.level &&
+             other.file == site.file && other.types == site.types;
+    };
+    if (std::none_of(sites.begin(), sites.end(), same))
+      sites.push_back(std::move(site));
+    pos += entry.size;
+  }
+}
+
+#ifdef SLUG_ELF
+
+/// \brief Reads size bytes at offset of a file
+bool read_at(std::istream& in, std::uint64_t const offset,
+             std::uint64_t const size, std::string& out) {
+  out.resize(size);
+  in.seekg(static_cast<std::streamoff>(offset));
+  in.read(out.data(), static_cast<std::streamsize>(size));
+  return static_cast<bool>(in);
+}
+
+/// \brief Finds the catalog section through the section headers and parses
+/// it
+template <typename Ehdr, typename Shdr>
+bool read_catalog_section(std::istream& in, std::vector<catalog_site>& sites) {
+  auto header = std::string{};
+  if (!read_at(in, 0, sizeof(Ehdr), header)) return false;
+  auto ehdr = Ehdr{};
+  std::memcpy(&ehdr, header.data(), sizeof(ehdr));
+  if (ehdr.e_shoff == 0) return true;
+  if (ehdr.e_shentsize != sizeof(Shdr) || ehdr.e_shstrndx >= ehdr.e_shnum)
+    return false;
+
+  auto table = std::string{};
+  if (!read_at(in, ehdr.e_shoff, std::uint64_t{ehdr.e_shnum} * sizeof(Shdr),
+               table))
+    return false;
+  auto shdrs = std::vector<Shdr>(ehdr.e_shnum);
+  std::memcpy(shdrs.data(), table.data(), table.size());
+
+  auto names = std::string{};
+  auto const& strtab = shdrs[ehdr.e_shstrndx];
+  if (!read_at(in, strtab.sh_offset, strtab.sh_size, names)) return false;
+
+  constexpr auto section = std::string_view{"slug_catalog"};
+  for (auto const& shdr : shdrs) {
+    if (shdr.sh_type == SHT_NOBITS || shdr.sh_name >= names.size() ||
+        names.c_str() + shdr.sh_name != section)
+      continue;
+
+    auto data = std::string{};
+    if (!read_at(in, shdr.sh_offset, shdr.sh_size, data)) return false;
+    parse_catalog(data.data(), data.size(), sites);
+  }
+  return true;
+}
+
+#endif
+
+}  // namespace
+
+std::vector<catalog_site> program_catalog() {
+  auto sites = std::vector<catalog_site>{};
+#ifdef SLUG_CATALOG
+  if (__start_slug_catalog != nullptr) {
+    parse_catalog(__start_slug_catalog,
+                  static_cast<std::size_t>(__stop_slug_catalog -
+                                           __start_slug_catalog),
+                  sites);
+  }
+#endif
+  return sites;
+}
+
+bool read_catalog(std::filesystem::path const& filepath,
+                  std::vector<catalog_site>& sites) {
+#ifdef SLUG_ELF
+  auto in = std::ifstream{filepath, std::ios::binary};
+  unsigned char ident[EI_NIDENT];
+  if (!in.read(reinterpret_cast<char*>(ident), sizeof(ident)) ||
+      std::memcmp(ident, ELFMAG, SELFMAG) != 0)
+    return false;
+
+  // Entries are stored in the byte order of the binary's target
+  constexpr std::uint16_t probe = 1;
+  auto const little = *reinterpret_cast<unsigned char const*>(&probe) == 1;
+  if (ident[EI_DATA] != (little ? ELFDATA2LSB : ELFDATA2MSB)) return false;
+
+  if (ident[EI_CLASS] == ELFCLASS64)
+    return read_catalog_section<Elf64_Ehdr, Elf64_Shdr>(in, sites);
+  if (ident[EI_CLASS] == ELFCLASS32)
+    return read_catalog_section<Elf32_Ehdr, Elf32_Shdr>(in, sites);
+  return false;
+#else
+  static_cast<void>(filepath);
+  static_cast<void>(sites);
+  return false;
+#endif
+}
+
+namespace {
+
+/// \brief Writes a label value with backslashes, quotes, and newlines
+/// escaped
+void write_label_value(std::ostream& os, std::string const& value) {
+  for (auto const ch : value) {
+    if (ch == '\\' || ch == '"') {
+      os << '\\' << ch;
+    } else if (ch == '\n') {
+      os << "\\n";
+    } else {
+      os << ch;
+    }
+  }
+}
+
+/// \brief Writes the HELP and TYPE lines of a metric family
+void write_family(std::ostream& os, char const* const name,
+                  char const* const type, char const* const help) {
+  os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type
+     << '\n';
+}
+
+/// \brief Writes the name and sink label of a series
+void write_series(std::ostream& os, char const* const name,
+                  std::string const& sink) {
+  os << name << "{sink=\"";
+  write_label_value(os, sink);
+  os << '"';
+}
+
+}  // namespace
+
+void write_prometheus(
+    std::ostream& os,
+    std::vector<std::pair<std::string, sink_metrics>> const& sinks) {
+  static constexpr char const* levels[] = {"trace", "info",  "warn",
+                                           "error", "fatal", "none"};
+
+  write_family(os, "slug_records_total", "counter",
+               "Records written to the sink by level.");
+  for (auto const& [name, metrics] : sinks) {
+    for (auto i = std::size_t{0}; i < metrics.records.size(); ++i) {
+      write_series(os, "slug_records_total", name);
+      os << ",level=\"" << levels[i] << "\"} " << metrics.records[i] << '\n';
+    }
+  }
+
+  auto const write_counter = [&](char const* const family,
+                                 char const* const type,
+                                 char const* const help, auto const member) {
+    write_family(os, family, type, help);
+    for (auto const& [name, metrics] : sinks) {
+      write_series(os, family, name);
+      os << "} " << metrics.*member << '\n';
+    }
+  };
+  write_counter("slug_bytes_total", "counter",
+                "Bytes of the records written to the sink.",
+                &sink_metrics::bytes);
+  write_counter("slug_dropped_total", "counter",
+                "Records dropped because the writer stalled.",
+                &sink_metrics::dropped);
+  write_counter("slug_lost_total", "counter",
+                "Records lost because of write errors.", &sink_metrics::lost);
+  write_counter("slug_spilled_records", "gauge",
+                "Records held back because of write errors.",
+                &sink_metrics::spilled);
+
+  write_family(os, "slug_write_seconds", "histogram",
+               "Time spent writing records to the output stream.");
+  for (auto const& [name, metrics] : sinks) {
+    auto count = std::uint64_t{0};
+    for (auto i = std::size_t{0}; i < metrics.write_latency.size(); ++i) {
+      count += metrics.write_latency[i];
+      write_series(os, "slug_write_seconds_bucket", name);
+      os << ",le=\"";
+      if (i < sink_metrics::latency_bounds.size())
+        os << double(sink_metrics::latency_bounds[i]) / 1e9;
+      else
+        os << "+Inf";
+      os << "\"} " << count << '\n';
+    }
+    write_series(os, "slug_write_seconds_sum", name);
+    os << "} " << double(metrics.write_time) / 1e9 << '\n';
+    write_series(os, "slug_write_seconds_count", name);
+    os << "} " << count << '\n';
+  }
+}
+
+metrics_exporter::metrics_exporter(std::filesystem::path filepath,
+                                   std::chrono::milliseconds const interval)
+    : m_path{std::move(filepath)}, m_interval{interval} {
+  m_thread = std::thread{[this] { run(); }};
+}
+
+metrics_exporter::~metrics_exporter() {
+  {
+    auto l = std::lock_guard{m_mtx};
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+  write_now();
+}
+
+metrics_exporter& metrics_exporter::add_source(std::string name, source src) {
+  auto l = std::lock_guard{m_mtx};
+  m_sources.emplace_back(std::move(name), std::move(src));
+  return *this;
+}
+
+bool metrics_exporter::write_now() {
+  auto sinks = std::vector<std::pair<std::string, sink_metrics>>{};
+  {
+    auto l = std::lock_guard{m_mtx};
+    auto it = m_sources.begin();
+    while (it != m_sources.end()) {
+      auto metrics = sink_metrics{};
+      if (!it->second(metrics)) {
+        it = m_sources.erase(it);
+        continue;
+      }
+      sinks.emplace_back(it->first, metrics);
+      ++it;
+    }
+  }
+
+  auto tmp = m_path;
+  tmp += ".tmp";
+  {
+    errno = 0;
+    auto out = std::ofstream{tmp, std::ios_base::trunc};
+    write_prometheus(out, sinks);
+    out.close();
+    if (!out) {
+      detail::report_error(detail::last_error(),
+                           "slug: failed to write metrics file");
+      return false;
+    }
+  }
+
+  auto ec = std::error_code{};
+  std::filesystem::rename(tmp, m_path, ec);
+  if (ec) {
+    detail::report_error(ec, "slug: failed to replace metrics file");
+    return false;
+  }
+  return true;
+}
+
+void metrics_exporter::run() {
+  auto l = std::unique_lock{m_mtx};
+  while (!m_cv.wait_for(l, m_interval, [this] { return m_stop; })) {
+    l.unlock();
+    write_now();
+    l.lock();
+  }
+}
+
+namespace {
+
+/// \brief Removes leading and trailing whitespace
+std::string_view trim(std::string_view str) noexcept {
+  auto const first = str.find_first_not_of(" \t\r");
+  if (first == std::string_view::npos) return {};
+  return str.substr(first, str.find_last_not_of(" \t\r") - first + 1);
+}
+
+/// \brief Compares strings ignoring ASCII case
+bool iequals(std::string_view const lhs, std::string_view const rhs) noexcept {
+  auto const lower = [](char const ch) {
+    return ch >= 'A' && ch <= 'Z' ? char(ch - 'A' + 'a') : ch;
+  };
+  return lhs.size() == rhs.size() &&
+         std::equal(lhs.begin(), lhs.end(), rhs.begin(),
+                    [&](char const l, char const r) {
+                      return lower(l) == lower(r);
+                    });
+}
+
+/// \brief Finds an enumerator by name, ignoring case
+template <typename E>
+bool parse_enum(std::string const* const text, E& value) {
+  if (text == nullptr) return false;
+  auto const& names = detail::enum_names<E>;
+  for (auto i = std::size_t{0}; i < names.size(); ++i) {
+    if (!names[i].empty() && iequals(names[i], *text)) {
+      value = static_cast<E>(enum_range<E>::min + static_cast<int>(i));
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+config config::parse(std::istream& is) {
+  auto cfg = config{};
+  for (auto line = std::string{}; std::getline(is, line);) {
+    auto text = std::string_view{line};
+    text = trim(text.substr(0, text.find('#')));
+    if (text.empty()) continue;
+
+    auto const eq = text.find('=');
+    auto const key = trim(text.substr(0, eq));
+    if (eq == std::string_view::npos || key.empty()) {
+      detail::report_error(std::make_error_code(std::errc::invalid_argument),
+                           "slug: malformed configuration line");
+      continue;
+    }
+    cfg.m_values[std::string{key}] = std::string{trim(text.substr(eq + 1))};
+  }
+  return cfg;
+}
+
+std::string const* config::value(std::string_view const key) const {
+  auto const it = m_values.find(key);
+  return it != m_values.end() ? &it->second : nullptr;
+}
+
+bool config::level(std::string_view const key, log_level& lvl) const {
+  return parse_enum(value(key), lvl);
+}
+
+bool config::policy(std::string_view const key, stall_policy& policy) const {
+  return parse_enum(value(key), policy);
+}
+
+bool config::number(std::string_view const key, std::uint64_t& num) const {
+  auto const* const text = value(key);
+  if (text == nullptr) return false;
+  auto const end = text->data() + text->size();
+  auto const [ptr, ec] = std::from_chars(text->data(), end, num);
+  return ec == std::errc{} && ptr == end;
+}
+
+config_watcher::config_watcher(std::filesystem::path filepath,
+                               std::chrono::milliseconds const interval)
+    : m_path{std::move(filepath)}, m_interval{interval} {
+  auto notify_fd = -1;
+#ifdef SLUG_INOTIFY
+  // Watch before the first load so no change can slip in between
+  auto const dir = m_path.has_parent_path() ? m_path.parent_path()
+                                            : std::filesystem::path{"."};
+  notify_fd = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (notify_fd != -1 &&
+      (::inotify_add_watch(notify_fd, dir.c_str(),
+                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1 ||
+       ::pipe2(m_wake.data(), O_CLOEXEC) != 0)) {
+    ::close(notify_fd);
+    notify_fd = -1;
+  }
+#endif
+  m_config_atm.store(new config{});
+  reload();
+  m_thread = std::thread{[this, notify_fd] { run(notify_fd); }};
+}
+
+config_watcher::~config_watcher() {
+  {
+    auto l = std::lock_guard{m_mtx};
+    m_stop = true;
+  }
+  m_cv.notify_all();
+#ifdef SLUG_INOTIFY
+  if (m_wake[1] != -1) detail::write_append(m_wake[1], "", 1);
+#endif
+  m_thread.join();
+#ifdef SLUG_INOTIFY
+  for (auto const fd : m_wake) {
+    if (fd != -1) ::close(fd);
+  }
+#endif
+  delete m_config_atm.load();
+}
+
+config_watcher& config_watcher::add_applier(applier apply) {
+  auto l = std::lock_guard{m_mtx};
+  if (apply(*m_config_atm.load())) m_appliers.push_back(std::move(apply));
+  return *this;
+}
+
+bool config_watcher::reload() {
+  auto in = std::ifstream{m_path};
+  if (!in) {
+    detail::report_error(std::make_error_code(std::errc::io_error),
+                         "slug: failed to read configuration file");
+    return false;
+  }
+  auto next = std::make_unique<config const>(config::parse(in));
+
+  auto l = std::lock_guard{m_mtx};
+  auto const prev =
+      std::unique_ptr<config const>{m_config_atm.exchange(next.release())};
+
+  // Reads that may hold the previous configuration raised a count before
+  // the exchange. Each phase flip sends new reads to the other count, so
+  // the count left behind drains even while reads never stop; after both
+  // counts have drained once, no read holds the previous configuration
+  for (auto flip = 0; flip < 2; ++flip) {
+    auto const& readers_atm = m_readers_atm[m_phase_atm.fetch_add(1) & 1];
+    while (readers_atm.load() != 0) std::this_thread::yield();
+  }
+
+  auto const& cfg = *m_config_atm.load();
+  m_appliers.erase(
+      std::remove_if(m_appliers.begin(), m_appliers.end(),
+                     [&](applier const& apply) { return !apply(cfg); }),
+      m_appliers.end());
+  return true;
+}
+
+void config_watcher::run(int const notify_fd) {
+#ifdef SLUG_INOTIFY
+  if (notify_fd != -1) {
+    auto const name = m_path.filename().native();
+    alignas(inotify_event) char buf[4096];
+    pollfd fds[] = {{notify_fd, POLLIN, 0}, {m_wake[0], POLLIN, 0}};
+
+    for (;;) {
+      // revents are only valid after a successful poll
+      if (::poll(fds, 2, -1) == -1) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      if (fds[1].revents != 0) break;
+      if ((fds[0].revents & POLLIN) == 0) continue;
+
+      auto const n = ::read(notify_fd, buf, sizeof(buf));
+      auto changed = false;
+      for (auto pos = ssize_t{0}; pos < n;) {
+        auto const* const event = reinterpret_cast<inotify_event*>(buf + pos);
+        changed = changed || (event->len != 0 && event->name == name);
+        pos += ssize_t(sizeof(inotify_event) + event->len);
+      }
+      if (changed) reload();
+    }
+    ::close(notify_fd);
+    return;
+  }
+#else
+  (void)notify_fd;
+#endif
+
+  // Polling fallback comparing the modification time and size; the first
+  // check always reloads, covering changes made while the thread started
+  auto const stamp = [this] {
+    auto ec = std::error_code{};
+    return std::pair{std::filesystem::last_write_time(m_path, ec),
+                     std::filesystem::file_size(m_path, ec)};
+  };
+  auto last = decltype(stamp()){};
+  auto l = std::unique_lock{m_mtx};
+  while (!m_cv.wait_for(l, m_interval, [this] { return m_stop; })) {
+    l.unlock();
+    if (auto const now = stamp(); now != last) {
+      last = now;
+      reload();
+    }
+    l.lock();
+  }
+}
+
 }  // namespace slug
@@ -0,0 +1,200 @@
+#include <slug.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/// \brief Fails the test with a message, also in builds with NDEBUG
+void check(bool const cond, char const* const what) {
+  if (!cond) {
+    std::fprintf(stderr, "slug_stress_test: %s\n", what);
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+/// \brief Reads a numeric command line argument
+std::size_t arg(int const argc, char** const argv, int const i,
+                std::size_t const fallback) {
+  return i < argc ? std::strtoul(argv[i], nullptr, 10) : fallback;
+}
+
+/// \brief Number of payload characters of a record
+constexpr std::size_t payload_size(std::size_t const seq) {
+  return seq % 61;
+}
+
+/// \brief Parses "w=<writer> seq=<seq> <payload>" following the logger name
+/// in a record and checks the payload
+/// \returns false if the record is malformed, e.g. interleaved with another
+bool parse_record(std::string_view line, std::string_view const name,
+                  std::size_t& writer, std::size_t& seq) {
+  auto const tag = line.find(name);
+  if (tag == std::string_view::npos) return false;
+  line.remove_prefix(tag + name.size());
+
+  auto const count = std::sscanf(std::string{line}.c_str(), "w=%zu seq=%zu",
+                                 &writer, &seq);
+  if (count != 2) return false;
+
+  auto const payload = line.substr(line.find(' ', line.find("seq=")) + 1);
+  return payload.size() == payload_size(seq) &&
+         payload.find_first_not_of('x') == std::string_view::npos;
+}
+
+/// \brief Returns a latency percentile in nanoseconds
+long long percentile(std::vector<long long> const& sorted, double const p) {
+  if (sorted.empty()) return 0;
+  auto const i = static_cast<std::size_t>(p * double(sorted.size() - 1));
+  return sorted[i];
+}
+
+}  // namespace
+
+/// Usage: slug_stress_test [writers] [records per writer]
+///
+/// Writers log records at a fixed level through one logger while other
+/// threads log through a second logger whose level keeps changing, and the
+/// sink is repeatedly switched between two files and the console. Every
+/// record of the first logger must be found exactly once, whole, and in
+/// order per file; records of the second logger must be whole.
+int main(int argc, char** argv) {
+  auto const writers = arg(argc, argv, 1, 8);
+  auto const records = arg(argc, argv, 2, 5000);
+
+  auto const dir = std::filesystem::temp_directory_path();
+  auto const paths = std::vector{dir / "slug_stress_a.log",
+                                 dir / "slug_stress_b.log"};
+  for (auto const& path : paths) std::filesystem::remove(path);
+
+  // Records written while the sink is closed go to the console
+  auto console = std::stringbuf{};
+  auto* const clog_buf = std::clog.rdbuf(&console);
+
+  auto const sink = std::make_shared<slug::logsink>(paths[0]);
+
+  // Optional per-thread batch size in characters
+  if (auto const* const batch = std::getenv("SLUG_STRESS_BATCH"))
+    sink->batch(std::strtoul(batch, nullptr, 10));
+  auto const data_log = slug::logger{sink, "data", slug::info};
+  auto noise = slug::logger{sink, "noise", slug::info};
+
+  auto done = std::atomic<bool>{false};
+  auto latencies = std::vector<std::vector<long long>>(writers);
+  auto threads = std::vector<std::thread>{};
+
+  for (auto w = std::size_t{0}; w < writers; ++w) {
+    threads.emplace_back([&, w] {
+      auto& lat = latencies[w];
+      lat.reserve(records);
+      for (auto seq = std::size_t{0}; seq < records; ++seq) {
+        auto const payload = std::string(payload_size(seq), 'x');
+        auto const begin = std::chrono::steady_clock::now();
+        data_log.info("w=", w, " seq=", seq, ' ', payload);
+        auto const end = std::chrono::steady_clock::now();
+        lat.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+                .count());
+      }
+    });
+
+    threads.emplace_back([&, w] {
+      for (auto seq = std::size_t{0}; !done.load(); ++seq) {
+        auto const payload = std::string(payload_size(seq), 'x');
+        if (seq % 4 == 0) {
+          noise.trace("w=", w, " seq=", seq, ' ', payload);
+        } else if (seq % 4 == 1) {
+          noise.info("w=", w, " seq=", seq, ' ', payload);
+        } else if (seq % 4 == 2) {
+          noise.warning("w=", w, " seq=", seq, ' ', payload);
+        } else {
+          noise.error("w=", w, " seq=", seq, ' ', payload);
+        }
+      }
+    });
+  }
+
+  auto control = std::thread{[&] {
+    constexpr slug::log_level levels[] = {slug::trace, slug::info, slug::warn,
+                                          slug::none};
+    for (auto i = std::size_t{0}; !done.load(); ++i) {
+      noise.min_log_level(levels[i % std::size(levels)]);
+      if (i % 16 == 15) {
+        sink->close_file();
+      } else if (i % 4 == 3) {
+        sink->open_file(paths[(i / 4) % paths.size()]);
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds{200});
+    }
+  }};
+
+  for (auto w = std::size_t{0}; w < writers; ++w) threads[2 * w].join();
+  done.store(true);
+  for (auto w = std::size_t{0}; w < writers; ++w) threads[2 * w + 1].join();
+  control.join();
+
+  sink->close_file();
+  std::clog.rdbuf(clog_buf);
+
+  auto next = std::vector<std::size_t>(writers, 0);
+  auto found = std::vector<std::size_t>(writers, 0);
+  auto const verify = [&](std::istream& in) {
+    std::fill(next.begin(), next.end(), 0);
+    for (auto line = std::string{}; std::getline(in, line);) {
+      auto writer = std::size_t{};
+      auto seq = std::size_t{};
+      if (line.find("[noise] ") != std::string::npos) {
+        check(parse_record(line, "[noise] ", writer, seq),
+              "malformed noise record");
+        continue;
+      }
+      check(parse_record(line, "[data] ", writer, seq),
+            "malformed data record");
+      check(writer < writers, "unknown writer");
+      check(seq >= next[writer], "records out of order");
+      next[writer] = seq + 1;
+      ++found[writer];
+    }
+  };
+
+  for (auto const& path : paths) {
+    auto in = std::ifstream{path};
+    verify(in);
+  }
+  auto console_in = std::istringstream{console.str()};
+  verify(console_in);
+
+  for (auto w = std::size_t{0}; w < writers; ++w)
+    check(found[w] == records, "records lost or duplicated");
+
+  auto all = std::vector<long long>{};
+  for (auto const& lat : latencies)
+    all.insert(all.end(), lat.begin(), lat.end());
+  std::sort(all.begin(), all.end());
+
+  std::printf("%zu writers x %zu records, latency ns: p50 %lld p90 %lld "
+              "p99 %lld p99.9 %lld max %lld\n",
+              writers, records, percentile(all, 0.5), percentile(all, 0.9),
+              percentile(all, 0.99), percentile(all, 0.999),
+              all.empty() ? 0 : all.back());
+
+  // Optional regression threshold for the 99th percentile in nanoseconds
+  if (auto const* const max_p99 = std::getenv("SLUG_STRESS_MAX_P99_NS")) {
+    check(percentile(all, 0.99) <= std::atoll(max_p99),
+          "99th percentile latency above SLUG_STRESS_MAX_P99_NS");
+  }
+
+  for (auto const& path : paths) std::filesystem::remove(path);
+}
@@ -1,7 +1,1017 @@
 #include <slug.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <csignal>
+#endif
+
+#ifdef SLUG_TEST_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef NDEBUG
+#error "slug_test checks its results with assert and needs NDEBUG undefined"
+#endif
+
+enum class color { red, green, blue };
+enum shade : int { light, dark };
+enum legacy_shade { legacy_light, legacy_dark };
+
+auto reported_errors = std::atomic<int>{0};
+auto reported_timeouts = std::atomic<int>{0};
+
+#ifdef __linux__
+/// \brief FIFO holding a page that nothing reads until drained, so a sink
+/// writing a larger record to it blocks inside the write
+class blocking_fifo {
+  int m_fd;
+
+ public:
+  std::filesystem::path const path{std::filesystem::temp_directory_path() /
+                                   "slug_stall.fifo"};
+
+  blocking_fifo() {
+    std::filesystem::remove(path);
+    ::mkfifo(path.c_str(), 0600);
+    m_fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    ::fcntl(m_fd, F_SETPIPE_SZ, 4096);
+  }
+
+  ~blocking_fifo() {
+    ::close(m_fd);
+    std::filesystem::remove(path);
+  }
+
+  /// \brief Waits until a writer has filled the FIFO
+  void wait_full() const {
+    for (auto n = 0; ::ioctl(m_fd, FIONREAD, &n) == 0 && n < 4096;)
+      std::this_thread::yield();
+  }
+
+  /// \brief Reads everything written so far
+  void drain() const {
+    char buf[4096];
+    while (::read(m_fd, buf, sizeof(buf)) > 0) {
+    }
+  }
+};
+#endif
+
+#ifdef SLUG_TEST_ZLIB
+/// \brief Decompresses a gzip file whose stream may not be finished
+/// \returns Decompressed contents and whether the stream was finished
+std::pair<std::string, bool> gunzip(std::filesystem::path const& path) {
+  auto in = std::ifstream{path, std::ios::binary};
+  auto data = std::string{std::istreambuf_iterator<char>{in}, {}};
+
+  auto strm = z_stream{};
+  inflateInit2(&strm, 15 + 16);
+  strm.next_in = reinterpret_cast<Bytef*>(data.data());
+  strm.avail_in = static_cast<uInt>(data.size());
+
+  auto out = std::string{};
+  auto rc = Z_OK;
+  while (rc == Z_OK) {
+    char buf[4096];
+    strm.next_out = reinterpret_cast<Bytef*>(buf);
+    strm.avail_out = sizeof(buf);
+    rc = inflate(&strm, Z_NO_FLUSH);
+    out.append(buf, sizeof(buf) - strm.avail_out);
+  }
+  inflateEnd(&strm);
+  return {out, rc == Z_STREAM_END};
+}
+#endif
+
 int main() {
   slug::g_logger.error("error", " test", " error");
 
   auto const* stream = &slug::g_logger.stream();
+
+  {
+    auto const previous = slug::set_error_handler(
+        [](std::error_code const& ec, char const*) {
+          if (ec == std::errc::timed_out) ++reported_timeouts;
+        });
+
+    auto stall_logger = slug::logger{slug::info};
+    stall_logger.stall_timeout(std::chrono::milliseconds{10})
+        .on_stall(slug::stall_policy::Drop);
+
+    // A lock holder that is not writing is waited for, not treated as stalled
+    {
+      auto l{stall_logger.lock_stream()};
+      auto waiter = std::thread{[&] { stall_logger.error("waited"); }};
+      std::this_thread::sleep_for(std::chrono::milliseconds{50});
+      l.unlock();
+      waiter.join();
+    }
+    assert(stall_logger.dropped_count() == 0);
+    assert(!stall_logger.stalled() && reported_timeouts == 0);
+
+#ifdef __linux__
+    auto const fifo = blocking_fifo{};
+    stall_logger.sink()->open_file(fifo.path);
+    auto done = std::atomic<bool>{false};
+    auto writer = std::thread{[&] {
+      stall_logger.info(std::string(8192, 'x'));
+      done = true;
+    }};
+    fifo.wait_full();
+    std::thread{[&] { stall_logger.error("stalled"); }}.join();
+    assert(stall_logger.dropped_count() == 1);
+    assert(stall_logger.stalled());
+    assert(reported_timeouts == 1);
+
+    while (!done) fifo.drain();
+    writer.join();
+    assert(!stall_logger.stalled());
+    stall_logger.sink()->close_file();
+#endif
+
+    slug::set_error_handler(previous);
+  }
+
+  {
+    static_assert(std::is_move_constructible_v<slug::logstream>);
+    static_assert(std::is_move_assignable_v<slug::logstream>);
+
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_moved.log";
+    std::filesystem::remove(path);
+
+    auto lstrm = slug::logstream{};
+    lstrm.open_shared(path);
+    lstrm << "first" << std::endl;
+    auto moved = std::move(lstrm);
+    assert(moved.is_shared() && !lstrm.is_open());
+    moved << "second" << std::endl;
+    lstrm = std::move(moved);
+    lstrm << "third" << std::endl;
+    assert(lstrm.good());
+    lstrm.close();
+
+    auto in = std::ifstream{path};
+    auto const text = std::string{std::istreambuf_iterator<char>{in}, {}};
+    assert(text == "first\nsecond\nthird\n");
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_shared.log";
+    std::filesystem::remove(path);
+
+    auto shared_logger = slug::logger{slug::info};
+    shared_logger.open_shared_file(path, 16, slug::oversize_policy::Lock);
+    shared_logger.info("a record longer than the atomic write size");
+    assert(shared_logger.memory_used().stream_buffers > 0);
+    shared_logger.close_file();
+    assert(shared_logger.memory_used().stream_buffers == 0);
+
+    auto line = std::string{};
+    std::getline(std::ifstream{path}, line);
+    assert(line.find("INFO:  a record longer than") != std::string::npos);
+    std::filesystem::remove(path);
+  }
+
+  {
+    // Batches larger than the atomic write size are split between records,
+    // so records of another writer never land inside one
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_shared_batch.log";
+    std::filesystem::remove(path);
+
+    auto writers = std::vector<std::thread>{};
+    for (auto const name : {"first", "second", "third", "fourth"}) {
+      writers.emplace_back([&path, name] {
+        auto shared_logger = slug::logger{slug::info};
+        shared_logger.open_shared_file(path, 64);
+        shared_logger.sink()->batch(512, std::chrono::hours{1});
+        for (auto i = 0; i < 2000; ++i)
+          shared_logger.info(name, " writer record ", i, " end");
+      });
+    }
+    for (auto& writer : writers) writer.join();
+
+    auto lines = 0;
+    auto in = std::ifstream{path};
+    for (auto line = std::string{}; std::getline(in, line); ++lines)
+      assert(line.front() == '[' && line.rfind('[') == 0 &&
+             line.rfind(" end") + 4 == line.size());
+    assert(lines == 8000);
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    // A record buffer grown by a large record shrinks only once small
+    // records have followed it for a while; doubles make records go
+    // through the record stream
+    auto const path = std::filesystem::temp_directory_path() / "slug_rec.log";
+    auto record_logger = slug::logger{path, slug::info};
+    record_logger.info("small ", 0.5);
+    auto const before = record_logger.memory_used().record_buffers;
+    record_logger.info(std::string(4096, 'x'));
+    record_logger.info("small ", 0.5);
+    auto const grown = record_logger.memory_used().record_buffers;
+    assert(grown > before);
+    for (auto i = 0; i < 64; ++i) record_logger.info("small ", i + 0.5);
+    assert(record_logger.memory_used().record_buffers < grown);
+
+    record_logger.info(std::string(128 * 1024, 'x'));
+    record_logger.info("small ", 0.5);
+    assert(record_logger.memory_used().record_buffers < grown);
+    record_logger.close_file();
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_buffered.log";
+    std::filesystem::remove(path);
+
+    auto buffered_logger = slug::logger{path, slug::info};
+    buffered_logger.info("before resize");
+    buffered_logger.buffer_size(64 * 1024);
+    assert(buffered_logger.memory_used().stream_buffers == 64 * 1024);
+    buffered_logger.info("after resize");
+    buffered_logger.buffer_size(512);
+    assert(buffered_logger.memory_used().stream_buffers == 512);
+    buffered_logger.close_file();
+
+    auto lines = 0;
+    auto in = std::ifstream{path};
+    for (auto line = std::string{}; std::getline(in, line);) ++lines;
+    assert(lines == 2);
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const trace = slug::stack_trace{};
+    assert(trace.size() > 0);
+
+    auto sstrm = std::ostringstream{};
+    sstrm << trace;
+    assert(sstrm.str().find("#0 ") != std::string::npos);
+  }
+
+  {
+    auto checks = 0;
+    SLUG_CHECK(++checks == 1, "checks ", checks);
+    SLUG_CHECK(checks == 1);
+    SLUG_DCHECK(checks != 0, "debug only");
+    assert(checks == 1);
+
+#ifdef __linux__
+    auto const path = std::filesystem::temp_directory_path() / "slug_check.log";
+    std::filesystem::remove(path);
+    auto const child = ::fork();
+    if (child == 0) {
+      auto other = slug::logger{path, slug::info};
+      other.sink()->batch(4096, std::chrono::hours{1});
+      other.info("pending");
+      SLUG_CHECK(checks == 2);
+    }
+    auto status = 0;
+    assert(::waitpid(child, &status, 0) == child);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    auto in = std::ifstream{path};
+    auto const flushed = std::string{std::istreambuf_iterator<char>{in}, {}};
+    assert(flushed.find("pending") != std::string::npos);
+#endif
+  }
+
+  {
+    static_assert(slug::enum_name(color::green) == "green");
+    static_assert(slug::enum_name(slug::log_level::Warn) == "Warn");
+    static_assert(slug::enum_name(static_cast<color>(7)).empty());
+    static_assert(slug::enum_name(dark) == "dark");
+    static_assert(slug::enum_name(legacy_dark).empty());
+
+    auto const path = std::filesystem::temp_directory_path() / "slug_enum.log";
+    std::filesystem::remove(path);
+
+    auto enum_logger = slug::logger{path, slug::info};
+    enum_logger.info(color::blue, ' ', static_cast<color>(7));
+    enum_logger.info(color::green, ' ', dark, ' ', legacy_dark);
+    enum_logger.close_file();
+
+    auto in = std::ifstream{path};
+    auto line = std::string{};
+    std::getline(in, line);
+    assert(line.find("INFO:  blue 7") != std::string::npos);
+    std::getline(in, line);
+    assert(line.find("INFO:  green 1 1") != std::string::npos);
+
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto handle_logger = slug::logger{slug::error};
+    auto const handle = handle_logger.handle();
+    assert(handle.min_log_level() == slug::error);
+
+    handle_logger.min_log_level(slug::trace);
+    auto const copy = handle;
+    assert(copy.min_log_level() == slug::trace);
+    assert(handle.min_log_level() == slug::trace);
+    assert(slug::log_handle{}.min_log_level() == slug::none);
+  }
+
+  {
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_sink.log";
+    std::filesystem::remove(path);
+
+    {
+      auto const net = slug::logger{path, slug::info};
+      auto const db = slug::logger{net.sink(), "db", slug::warn};
+      assert(slug::logger{path}.sink() == net.sink());
+
+      net.info("connected");
+      db.info("suppressed");
+      db.warning("slow query");
+    }
+
+    auto in = std::ifstream{path};
+    auto line = std::string{};
+    std::getline(in, line);
+    assert(line.find("INFO:  connected") != std::string::npos);
+    std::getline(in, line);
+    assert(line.find("WARN:  [db] slow query") != std::string::npos);
+    auto const more = static_cast<bool>(std::getline(in, line));
+    assert(!more);
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const previous = slug::set_error_handler(
+        [](std::error_code const&, char const*) { ++reported_errors; });
+
+    auto const missing = std::filesystem::temp_directory_path() /
+                         "slug_missing_dir" / "slug.log";
+    auto const missing_logger = slug::logger{missing, slug::info};
+    assert(missing_logger.status());
+    assert(reported_errors == 1);
+
+    slug::set_error_handler(previous);
+  }
+
+  {
+    static_assert(slug::detail::is_fixed_record<char const(&)[4], int, bool>);
+    static_assert(!slug::detail::is_fixed_record<int, std::string>);
+    static_assert(!slug::detail::is_fixed_record<double>);
+
+    auto const path = std::filesystem::temp_directory_path() / "slug_fixed.log";
+    std::filesystem::remove(path);
+
+    auto fixed_logger = slug::logger{path, slug::info};
+    fixed_logger.info("n=", -42, ' ', true, ' ', 18446744073709551615ull);
+    fixed_logger.info(std::string{"n="}, -42, ' ', true, ' ',
+                      18446744073709551615ull);
+    fixed_logger.close_file();
+
+    auto in = std::ifstream{path};
+    auto fixed = std::string{};
+    auto streamed = std::string{};
+    std::getline(in, fixed);
+    std::getline(in, streamed);
+    assert(fixed.rfind('[', 0) == 0);
+    assert(fixed.substr(fixed.find(']')) ==
+           streamed.substr(streamed.find(']')));
+    assert(fixed.find("INFO:  n=-42 1 18446744073709551615") !=
+           std::string::npos);
+
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto site_logger = slug::logger{slug::warn};
+    site_logger.sink()->open_file(std::filesystem::temp_directory_path() /
+                                  "slug_sites.log");
+    for (auto i = 0; i < 3; ++i) {
+      SLUG_WARN(site_logger, "call site ", i);
+      SLUG_INFO(site_logger, "suppressed ", i);
+    }
+    auto worker = std::thread{[&] { SLUG_ERROR(site_logger, "worker"); }};
+    worker.join();
+
+    auto const top = slug::top_call_sites(2);
+    assert(top.size() == 2);
+    assert(top[0].site->level() == slug::warn);
+    assert(top[0].emitted == 3 && top[0].dropped == 0 && top[0].bytes > 0);
+    assert(top[1].site->level() == slug::error && top[1].emitted == 1);
+
+    auto const all = slug::collect_call_site_stats();
+    assert(std::any_of(all.begin(), all.end(), [](auto const& stats) {
+      return stats.site->level() == slug::info && stats.suppressed == 3 &&
+             stats.emitted == 0;
+    }));
+
+    auto sstrm = std::ostringstream{};
+    slug::dump_call_sites(sstrm, 1);
+    assert(sstrm.str().find("Warn") != std::string::npos);
+
+    site_logger.close_file();
+    std::filesystem::remove(std::filesystem::temp_directory_path() /
+                            "slug_sites.log");
+  }
+
+  {
+    auto catalog_logger = slug::logger{slug::none};
+    auto const line = unsigned(__LINE__) + 1;
+    SLUG_INFO(catalog_logger, "catalog ", 1u, ' ', 2.5, slug::field("ok", 1));
+    SLUG_ERROR(catalog_logger, color::red);
+
+    auto const sites = slug::program_catalog();
+#ifdef __ELF__
+    auto const at = [&](unsigned const n) {
+      return std::find_if(sites.begin(), sites.end(), [&](auto const& site) {
+        return site.line == n &&
+               site.file.find("slug_test.cpp") != std::string::npos;
+      });
+    };
+    assert(at(line) != sites.end());
+    assert(at(line)->level == slug::info && at(line)->types == "sucfk");
+    assert(at(line + 1) != sites.end());
+    assert(at(line + 1)->level == slug::error && at(line + 1)->types == "e");
+    assert(std::count_if(sites.begin(), sites.end(), [](auto const& site) {
+             return site.file.find("slug_test.cpp") != std::string::npos;
+           }) == 7);
+#endif
+
+#ifdef __linux__
+    auto from_file = std::vector<slug::catalog_site>{};
+    auto const read = slug::read_catalog("/proc/self/exe", from_file);
+    assert(read);
+    assert(from_file.size() == sites.size());
+    for (auto i = std::size_t{0}; i < sites.size(); ++i) {
+      assert(from_file[i].file == sites[i].file);
+      assert(from_file[i].line == sites[i].line);
+      assert(from_file[i].types == sites[i].types);
+    }
+    auto const missing = slug::read_catalog("/nonexistent/slug", from_file);
+    assert(!missing);
+#endif
+  }
+
+  {
+    auto const dir = std::filesystem::temp_directory_path();
+    auto metrics_logger = slug::logger{dir / "slug_metrics.log", slug::info};
+    metrics_logger.info("one");
+    metrics_logger.warning("two");
+    metrics_logger.trace("suppressed");
+
+    auto const metrics = metrics_logger.sink()->metrics();
+    assert(metrics.records[std::size_t(slug::info)] == 1);
+    assert(metrics.records[std::size_t(slug::warn)] == 1);
+    assert(metrics.records[std::size_t(slug::trace)] == 0);
+    assert(metrics.bytes > 0 && metrics.dropped == 0);
+    assert(std::accumulate(metrics.write_latency.begin(),
+                           metrics.write_latency.end(), 0ull) == 2);
+
+    {
+      auto exporter = slug::metrics_exporter{dir / "slug_metrics.prom",
+                                             std::chrono::hours{1}};
+      exporter.add("app \"main\"", metrics_logger.sink());
+      auto const written = exporter.write_now();
+      assert(written);
+    }
+
+    auto in = std::ifstream{dir / "slug_metrics.prom"};
+    auto text = std::string{std::istreambuf_iterator<char>{in}, {}};
+    assert(text.find("# TYPE slug_records_total counter") !=
+           std::string::npos);
+    assert(text.find("slug_records_total{sink=\"app \\\"main\\\"\","
+                     "level=\"warn\"} 1") != std::string::npos);
+    assert(text.find("slug_write_seconds_bucket{sink=\"app \\\"main\\\"\","
+                     "le=\"+Inf\"} 2") != std::string::npos);
+    assert(!std::filesystem::exists(dir / "slug_metrics.prom.tmp"));
+
+    in.close();
+    metrics_logger.close_file();
+    std::filesystem::remove(dir / "slug_metrics.prom");
+    std::filesystem::remove(dir / "slug_metrics.log");
+  }
+
+  {
+    auto const dir = std::filesystem::temp_directory_path();
+    auto const write_config = [&](std::string const& text) {
+      std::ofstream{dir / "slug_config.tmp"} << text;
+      std::filesystem::rename(dir / "slug_config.tmp", dir / "slug.conf");
+    };
+    write_config(
+        "# test configuration\n"
+        "level = warn\n"
+        "level.db = TRACE\n"
+        "sink.main.stall_timeout = 250\n"
+        "sink.main.on_stall = drop\n");
+
+    auto app = slug::logger{slug::info};
+    auto db = slug::logger{app.sink(), "db", slug::info};
+    auto watcher = slug::config_watcher{dir / "slug.conf"};
+    watcher.add_logger("app", app).add_logger("db", db);
+    watcher.add_sink("main", app.sink());
+
+    assert(app.min_log_level() == slug::warn);
+    assert(db.min_log_level() == slug::trace);
+    assert(app.sink()->stall_timeout() == std::chrono::milliseconds{250});
+    assert(app.sink()->on_stall() == slug::stall_policy::Drop);
+    assert(*watcher.current().value("level") == "warn");
+
+    write_config("level = error\n");
+    for (auto i = 0; i < 200 && app.min_log_level() != slug::error; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    assert(app.min_log_level() == slug::error);
+    assert(db.min_log_level() == slug::error);
+    assert(watcher.current().value("level.db") == nullptr);
+    assert(watcher.read([](slug::config const& cfg) {
+      return *cfg.value("level") == "error";
+    }));
+
+    // Reloads finish while reads never stop, and a file set by the
+    // configuration is opened in the mode of the open file
+    auto const log_path = dir / "slug_config.log";
+    app.sink()->open_shared_file(dir / "slug_config_shared.log", 512);
+    auto stop = std::atomic<bool>{false};
+    auto reader = std::thread{[&] {
+      while (!stop) {
+        watcher.read([](slug::config const& cfg) {
+          return cfg.value("level") != nullptr;
+        });
+      }
+    }};
+    write_config("sink.main.file = " + log_path.string() + "\n");
+    for (auto i = 0; i < 20; ++i) {
+      auto const reloaded = watcher.reload();
+      assert(reloaded);
+    }
+    stop = true;
+    reader.join();
+    assert(app.sink()->path() == log_path);
+    {
+      auto l{app.lock_stream()};
+      assert(app.stream().is_shared() && app.stream().max_write() == 512);
+    }
+    app.sink()->close_file();
+
+    std::filesystem::remove(log_path);
+    std::filesystem::remove(dir / "slug_config_shared.log");
+    std::filesystem::remove(dir / "slug.conf");
+  }
+
+  {
+    static_assert(slug::field_key{"user.id"}.plain());
+    static_assert(!slug::field_key{"user id"}.plain());
+
+    auto const path = std::filesystem::temp_directory_path() / "slug_fmt.log";
+    std::filesystem::remove(path);
+
+    auto fmt_logger = slug::logger{path, slug::info};
+    fmt_logger.info("ready ", slug::field("port", 8080));
+    fmt_logger.sink()->format(slug::record_format::Logfmt);
+    fmt_logger.info("cache miss", slug::field("key", "a=\"b\""),
+                    slug::field("user id", 42), slug::field("empty", ""));
+    fmt_logger.warning("disk", slug::field("pct", 97));
+    fmt_logger.close_file();
+
+    auto in = std::ifstream{path};
+    auto lines = std::vector<std::string>{};
+    for (auto line = std::string{}; std::getline(in, line);)
+      lines.push_back(line);
+    assert(lines.size() == 3);
+    assert(lines[0].find("INFO:  ready port=8080") != std::string::npos);
+    assert(lines[1].rfind("elapsed=", 0) == 0);
+    assert(lines[1].find(" level=info msg=\"cache miss\" "
+                         "key=\"a=\\\"b\\\"\" user_id=42 empty=\"\"") !=
+           std::string::npos);
+    assert(lines[2].find(" level=warn msg=disk pct=97") != std::string::npos);
+
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    static_assert(slug::otel_severity[std::size_t(slug::warn)] == 13);
+
+    auto const path = std::filesystem::temp_directory_path() / "slug_otlp.log";
+    for (auto const* suffix : {"", ".1", ".2", ".3"})
+      std::filesystem::remove(path.string() + suffix);
+
+    auto otlp_logger = slug::logger{path, slug::info};
+    otlp_logger.sink()->format(slug::record_format::Otlp).rotate(1024, 2);
+    otlp_logger.error("quote \" done", slug::field("retries", 3),
+                      slug::field("ok", false), slug::field("ratio", 0.5));
+    auto in = std::ifstream{path};
+    auto line = std::string{};
+    std::getline(in, line);
+    in.close();
+    assert(line.rfind(R"({"resourceLogs":[{"resource":{},)", 0) == 0);
+    assert(line.find(R"("severityNumber":17,"severityText":"ERROR")") !=
+           std::string::npos);
+    assert(line.find(R"("body":{"stringValue":"quote \" done"})") !=
+           std::string::npos);
+    assert(line.find(R"({"key":"retries","value":{"intValue":"3"}})") !=
+           std::string::npos);
+    assert(line.find(R"({"key":"ok","value":{"boolValue":false}})") !=
+           std::string::npos);
+    assert(line.find(R"({"key":"ratio","value":{"doubleValue":0.5}})") !=
+           std::string::npos);
+    assert(line.find(R"(]}]}]}]})") == line.size() - 8);
+
+    for (auto i = 0; i < 64; ++i) otlp_logger.info("rotate ", i);
+    otlp_logger.close_file();
+    assert(std::filesystem::exists(path.string() + ".1"));
+    assert(std::filesystem::exists(path.string() + ".2"));
+    assert(!std::filesystem::exists(path.string() + ".3"));
+    assert(std::filesystem::file_size(path.string() + ".1") >= 1024);
+
+    for (auto const* suffix : {"", ".1", ".2"})
+      std::filesystem::remove(path.string() + suffix);
+  }
+
+  {
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_existing.log";
+    for (auto const* suffix : {"", ".1"})
+      std::filesystem::remove(path.string() + suffix);
+
+    // A file reopened after a restart counts toward its rotation size
+    std::ofstream{path} << std::string(1024, 'x') << '\n';
+    auto existing_logger = slug::logger{path, slug::info};
+    existing_logger.sink()->rotate(1024, 1);
+    existing_logger.info("rotated");
+    existing_logger.close_file();
+    assert(std::filesystem::exists(path.string() + ".1"));
+
+    for (auto const* suffix : {"", ".1"})
+      std::filesystem::remove(path.string() + suffix);
+  }
+
+  {
+    auto const path = std::filesystem::temp_directory_path() / "slug_batch.log";
+    std::filesystem::remove(path);
+
+    auto batch_logger = slug::logger{path, slug::info};
+    batch_logger.sink()->batch(4096, std::chrono::hours{1}, slug::warn);
+    assert(batch_logger.sink()->batch_size() == 4096);
+
+    auto const written = [&] {
+      return batch_logger.sink()->metrics().records[std::size_t(slug::info)];
+    };
+    for (auto i = 0; i < 10; ++i) batch_logger.info("batched ", i);
+    assert(written() == 0);
+    assert(batch_logger.memory_used().batch_buffers > 0);
+    batch_logger.warning("severe");
+    assert(written() == 10);
+
+    auto worker = std::thread{[&] { batch_logger.info("thread exit"); }};
+    worker.join();
+    assert(written() == 11);
+
+    batch_logger.info("flushed");
+    batch_logger.flush();
+    assert(written() == 12);
+
+    batch_logger.sink()->batch(4096, std::chrono::milliseconds{0});
+    batch_logger.info("aged");
+    assert(written() == 13);
+    batch_logger.sink()->batch(0);
+    batch_logger.info("unbatched");
+    assert(written() == 14);
+
+    // Records of every length survive the batch buffer's growth
+    batch_logger.sink()->batch(1000);
+    for (auto n = std::size_t{0}; n < 200; n += 7)
+      batch_logger.info(std::string(n, char('a' + n % 26)));
+    batch_logger.close_file();
+
+    auto lines = std::vector<std::string>{};
+    auto in = std::ifstream{path};
+    for (auto line = std::string{}; std::getline(in, line);)
+      lines.push_back(line);
+    assert(lines.size() == 15 + 29);
+    for (auto n = std::size_t{0}; n < 200; n += 7) {
+      auto const& line = lines[15 + n / 7];
+      assert(line.size() >= n &&
+             line.compare(line.size() - n, n,
+                          std::string(n, char('a' + n % 26))) == 0);
+    }
+    for (auto i = 0; i < 10; ++i)
+      assert(lines[std::size_t(i)].find("batched " + std::to_string(i)) !=
+             std::string::npos);
+    assert(lines[10].find("severe") != std::string::npos);
+    assert(lines[11].find("thread exit") != std::string::npos);
+    assert(lines[14].find("unbatched") != std::string::npos);
+
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+#ifdef __linux__
+  {
+    // A dropped batch counts every record in it
+    auto const fifo = blocking_fifo{};
+    auto stall_logger = slug::logger{fifo.path, slug::info};
+    stall_logger.stall_timeout(std::chrono::milliseconds{10})
+        .on_stall(slug::stall_policy::Drop);
+
+    auto const previous = slug::set_error_handler(
+        [](std::error_code const&, char const*) { ++reported_errors; });
+    auto done = std::atomic<bool>{false};
+    auto writer = std::thread{[&] {
+      stall_logger.info(std::string(8192, 'x'));
+      done = true;
+    }};
+    fifo.wait_full();
+    auto const line = unsigned(__LINE__) + 4;
+    std::thread{[&] {
+      stall_logger.sink()->batch(4096, std::chrono::hours{1}, slug::error);
+      for (auto i = 0; i < 3; ++i) {
+        SLUG_INFO(stall_logger, "batched ", i);
+      }
+      SLUG_ERROR(stall_logger, "stalled");
+    }}.join();
+    assert(stall_logger.dropped_count() == 4);
+
+    // Call sites count the records of the dropped batch as dropped too
+    auto const all = slug::collect_call_site_stats();
+    auto const at = [&](unsigned const l) {
+      return std::find_if(all.begin(), all.end(), [&](auto const& stats) {
+        return stats.site->line() == l;
+      });
+    };
+    assert(at(line)->emitted == 0 && at(line)->dropped == 3);
+    assert(at(line + 2)->emitted == 0 && at(line + 2)->dropped == 1);
+
+    while (!done) fifo.drain();
+    writer.join();
+    slug::set_error_handler(previous);
+  }
+
+  {
+    // An evicted batch counts every record in it as lost
+    auto const previous = slug::set_error_handler(
+        [](std::error_code const&, char const*) { ++reported_errors; });
+
+    auto const full = slug::logger{"/dev/full", slug::info};
+    full.sink()->spill_limit(1);
+    full.sink()->batch(4096, std::chrono::hours{1});
+    for (auto i = 0; i < 3; ++i) full.info("batched ", i);
+    full.flush();
+    assert(full.sink()->write_failed());
+    assert(full.sink()->lost_count() == 3);
+    assert(full.sink()->metrics().spilled == 0);
+
+    slug::set_error_handler(previous);
+  }
+#endif
+
+  {
+    auto const path = std::filesystem::temp_directory_path() / "slug_gzip.gz";
+    std::filesystem::remove(path);
+
+    auto const previous = slug::set_error_handler(
+        [](std::error_code const&, char const*) { ++reported_errors; });
+
+    auto gzip_logger = slug::logger{slug::info};
+    gzip_logger.open_compressed_file(path, 256, slug::default_compress_level,
+                                     slug::compression_codec::Gzip);
+    assert(gzip_logger.status() || slug::compression_supported());
+#ifdef SLUG_TEST_ZLIB
+    assert(slug::compression_supported());
+    for (auto i = 0; i < 100; ++i) gzip_logger.info("compressed ", i);
+    gzip_logger.flush();
+
+    // Flushed blocks decompress while the stream is still open
+    auto const [partial, partial_end] = gunzip(path);
+    assert(!partial_end);
+    assert(std::count(partial.begin(), partial.end(), '\n') == 100);
+    assert(partial.find("compressed 99\n") != std::string::npos);
+    assert(std::filesystem::file_size(path) < partial.size());
+
+    gzip_logger.info("last");
+    gzip_logger.close_file();
+    auto const [full, full_end] = gunzip(path);
+    assert(full_end);
+    assert(full.rfind(partial, 0) == 0);
+    assert(full.find("last\n") == full.size() - 5);
+#endif
+
+    slug::set_error_handler(previous);
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const path = std::filesystem::temp_directory_path() / "slug_lz.slz";
+    std::filesystem::remove(path);
+
+    auto lz_logger = slug::logger{slug::info};
+    lz_logger.open_compressed_file(path, 4096, slug::default_compress_level,
+                                   slug::compression_codec::Lz);
+    assert(!lz_logger.status());
+
+    auto noise = std::string{};
+    for (auto i = 0u; i < 3000; ++i)
+      noise += char(33 + (i * 2654435761u >> 16) % 90);
+    for (auto i = 0; i < 500; ++i) {
+      lz_logger.info("request ", i, " done ", slug::field("status", 200));
+      if (i % 100 == 0) lz_logger.info(std::string(1000, 'a'), noise);
+    }
+    lz_logger.close_file();
+
+    auto const size = std::filesystem::file_size(path);
+    auto decoded = std::ostringstream{};
+    auto const decompressed = slug::decompress_file(path, decoded, 4);
+    assert(decompressed);
+    auto const text = decoded.str();
+    assert(text.find("request 499 done status=200\n") != std::string::npos);
+    assert(std::count(text.begin(), text.end(), '\n') == 505);
+    assert(text.find(std::string(1000, 'a') + noise) != std::string::npos);
+    assert(size < text.size() / 2);
+
+    auto single = std::ostringstream{};
+    auto const single_decompressed = slug::decompress_file(path, single, 1);
+    assert(single_decompressed);
+    assert(single.str() == text);
+
+    // A file cut short decodes up to its last whole block
+    std::filesystem::resize_file(path, size - 3);
+    auto partial = std::ostringstream{};
+    auto const partial_decompressed = slug::decompress_file(path, partial, 4);
+    assert(!partial_decompressed);
+    assert(!partial.str().empty() && text.rfind(partial.str(), 0) == 0);
+    assert(partial.str().size() < text.size());
+
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_moved.slz";
+    std::filesystem::remove(path);
+
+    auto buf = slug::basic_compressbuf<char>{};
+    buf.open(path, 64, slug::default_compress_level,
+             slug::compression_codec::Lz);
+    buf.sputn("first\n", 6);
+    auto moved = std::move(buf);
+    assert(!buf.is_open() && moved.is_open());
+    moved.sputn("second\n", 7);
+    buf = std::move(moved);
+    assert(buf.is_open() && !moved.is_open());
+    buf.close();
+
+    auto decoded = std::ostringstream{};
+    auto const decompressed = slug::decompress_file(path, decoded);
+    assert(decompressed);
+    assert(decoded.str() == "first\nsecond\n");
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const path = std::filesystem::temp_directory_path() / "slug_long.log";
+    std::filesystem::remove(path);
+
+    auto long_logger = slug::logger{path, slug::info};
+    long_logger.sink()->record_limit(64);
+    long_logger.info(std::string(100, 'x'));
+
+    long_logger.sink()->on_long_record(slug::long_record_policy::Chunk);
+    long_logger.info(std::string(100, 'y'));
+    long_logger.close_file();
+
+    auto lines = std::vector<std::string>{};
+    auto in = std::ifstream{path};
+    for (auto line = std::string{}; std::getline(in, line);)
+      lines.push_back(line);
+    assert(lines.size() >= 3);
+    auto const kept = std::count(lines[0].begin(), lines[0].end(), 'x');
+    assert(lines[0].find(std::to_string(100 - kept) +
+                         " characters truncated]") != std::string::npos);
+    auto const count = std::to_string(lines.size() - 1);
+    auto joined = std::string{};
+    for (auto n = std::size_t{1}; n < lines.size(); ++n) {
+      auto const tag = "[chunk 1 " + std::to_string(n) + '/' + count + "] ";
+      assert(lines[n].rfind(tag, 0) == 0);
+      joined += lines[n].substr(tag.size());
+    }
+    assert(joined.find(std::string(100, 'y')) != std::string::npos);
+
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+#ifdef __linux__
+  {
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_resumed.log";
+    std::filesystem::remove(path);
+
+    auto const previous = slug::set_error_handler(
+        [](std::error_code const&, char const*) { ++reported_errors; });
+
+    auto const full = slug::logger{"/dev/full", slug::info};
+    full.sink()->spill_limit(128);
+    for (auto i = 0; i < 8; ++i) full.info("record ", i);
+    assert(full.sink()->write_failed());
+    assert(full.status() == std::errc::no_space_on_device);
+    assert(full.sink()->lost_count() > 0);
+
+    full.open_file(path);
+    assert(!full.sink()->write_failed());
+    assert(full.memory_used().spill_buffers == 0);
+
+    auto lines = 0;
+    auto in = std::ifstream{path};
+    for (auto line = std::string{}; std::getline(in, line);) ++lines;
+    assert(lines + full.sink()->lost_count() == 8);
+
+    slug::set_error_handler(previous);
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    auto const path =
+        std::filesystem::temp_directory_path() / "slug_refilled.log";
+    std::filesystem::remove(path);
+
+    auto const previous = slug::set_error_handler(
+        [](std::error_code const&, char const*) { ++reported_errors; });
+    auto const previous_signal = std::signal(SIGXFSZ, SIG_IGN);
+    auto limit = rlimit{};
+    ::getrlimit(RLIMIT_FSIZE, &limit);
+
+    // Writes fail with EFBIG once the file reaches its size limit, leaving
+    // the failed record pending in the file buffer
+    auto refilled = slug::logger{path, slug::info};
+    refilled.sink()->retry_backoff(std::chrono::milliseconds{0},
+                                   std::chrono::milliseconds{0});
+    refilled.info("record 0");
+    auto capped = limit;
+    capped.rlim_cur = std::filesystem::file_size(path);
+    ::setrlimit(RLIMIT_FSIZE, &capped);
+    refilled.info("record 1");
+    assert(refilled.sink()->write_failed());
+
+    ::setrlimit(RLIMIT_FSIZE, &limit);
+    refilled.info("record 2");
+    assert(!refilled.sink()->write_failed());
+    refilled.close_file();
+
+    auto records = std::string{};
+    auto in = std::ifstream{path};
+    for (auto line = std::string{}; std::getline(in, line);)
+      records += line.substr(line.find("record "));
+    assert(records == "record 0record 1record 2");
+
+    std::signal(SIGXFSZ, previous_signal);
+    slug::set_error_handler(previous);
+    in.close();
+    std::filesystem::remove(path);
+  }
+
+  {
+    int fds[2];
+    auto const piped = ::pipe(fds);
+    assert(piped == 0);
+    slug::signal_safe_fd(fds[1]);
+    slug::signal_safe_log(slug::fatal, "signal ", 11, ' ', -42, ' ', true,
+                          ' ', color::blue);
+    slug::signal_safe_fd(2);
+
+    char buf[slug::signal_record_size];
+    auto const n = ::read(fds[0], buf, sizeof(buf));
+    assert(std::string(buf, std::size_t(n)) ==
+           "[signal] FATAL: signal 11 -42 1 blue\n");
+    assert(slug::signal_safe_dropped() == 0);
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+#endif
 }
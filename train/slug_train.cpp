@@ -0,0 +1,77 @@
+#include <slug.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum class phase { startup, steady, shutdown };
+
+/// \brief Logs a representative mix of records, most of them disabled
+void run_workload(slug::logger const& log, int const iterations) {
+  auto const handle = log.handle();
+
+  for (auto i = 0; i < iterations; ++i) {
+    log.trace("trace ", i, " is usually disabled");
+    handle.trace("handle trace ", i);
+
+    if (i % 4 == 0) log.info("request ", i, " took ", i * 0.25, " ms");
+    if (i % 16 == 0) handle.warning("queue depth ", i % 97, ' ', phase::steady);
+    if (i % 64 == 0) log.error("request ", i, " failed: ", "timeout");
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  namespace fs = std::filesystem;
+
+  auto const dir = fs::path{argc > 1 ? argv[1] : "."};
+  auto const iterations = argc > 2 ? std::atoi(argv[2]) : 100000;
+  auto const text_path = dir / "slug_train.log";
+  auto const shared_path = dir / "slug_train_shared.log";
+
+  {
+    // Buffered file output from several threads through one shared sink
+    auto app = slug::logger{text_path, slug::info};
+    auto const net = slug::logger{app.sink(), "net", slug::warn};
+
+    app.info("training started ", phase::startup);
+
+    auto threads = std::vector<std::thread>{};
+    for (auto t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t] {
+        run_workload(t % 2 == 0 ? app : net, iterations);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+
+    // Stall detection enabled without an actual stall
+    app.stall_timeout(std::chrono::milliseconds{500})
+        .on_stall(slug::stall_policy::Drop);
+    run_workload(app, iterations / 4);
+
+    app.info("training finished ", phase::shutdown);
+  }
+
+  {
+    // Single-write appends to a file shared between processes
+    auto const shared = slug::logger{slug::info};
+    shared.open_shared_file(shared_path, 256);
+    run_workload(shared, iterations / 4);
+    shared.info(std::string(1024, 'x'));
+  }
+
+  {
+    // Everything disabled, which is the most frequent case in production
+    auto const quiet = slug::logger{slug::none};
+    run_workload(quiet, iterations * 4);
+  }
+
+  fs::remove(text_path);
+  fs::remove(shared_path);
+}